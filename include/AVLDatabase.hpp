@@ -1,73 +1,892 @@
 #ifndef AVLDATABASE_INCLUDED
 #define AVLDATABASE_INCLUDED
 
+#include <iostream>
 #include <string>
-#include <filesystem>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
 
-template <typename T>
+#include "AVLTree.hpp"
+#include "AsyncIO.hpp"
+#include "Checksum.hpp"
+#include "FileIO.hpp"
+#include "FileStorage.hpp"
+#include "Serializers.hpp"
+
+/* A persistent table of records looked up by key
+
+   the body file holds (key, record) pairs and is only ever appended to: an update
+   writes the new record at the end and frees the old slot. keys are mapped to body
+   slots by an in memory AVL tree, so that lookups are O(log n) and fetching a record
+   takes a single read. writes to the body are batched
+
+   CHECKPOINT FORMAT (idxPath)
+   (CheckpointHeader) header
+   (key, uint64_t slot)[] one entry per key, in key order
+
+   on open the checkpoint is mapped and bulk loaded into a balanced tree in O(n).
+   the keys removed since are replayed from the removal log (idxPath + ".log", of
+   (key, generation) pairs), and then the body records appended after the watermark
+
+   secondary indexes map a field of the records to their slots, and are checkpointed
+   the same way at idxPath + "." + name, as (field, uint64_t slot) entries
+
+   MOVES FORMAT (idxPath + ".moves")
+   (uint64_t) generation of the checkpoint the moves follow
+   (uint64_t) count
+   (uint64_t from, uint64_t to)[] body slots of the records moved by a rewrite
+   (uint32_t) CRC32C of every field above
+
+   rewrite() saves its moves before making them, and drops them once the checkpoint
+   after them is written. if it crashes in between, the next open makes the moves
+   again and maps the keys of the moved records to their new slots
+
+   snapshots read the table as of the version they were taken at, alongside the
+   single writer. every change gets a version, and while snapshots are open the slot
+   each key had before a change is kept in its version chain. freed slots stay
+   readable, since the body only grows until rewrite(), which does not compact
+   while snapshots are open. chains no snapshot needs are dropped in the background */
+template <typename K,
+          typename T,
+          class Less = std::less<K>,
+          class KeySerializer = BinarySerializer<K>,
+          class Serializer = BinarySerializer<T>>
 class AVLDatabase {
     private:
-        FileStorage index;
-        FileStorage body;
+        typedef std::pair<K, T> Record;
+        typedef std::pair<K, uint64_t> IndexEntry;
+        typedef PairSerializer<K, uint64_t, KeySerializer> EntrySerializer;
+
+        // orders index entries by key only
+        struct KeyLess {
+            bool operator()(const IndexEntry& a, const IndexEntry& b) const {
+                return Less()(a.first, b.first);
+            }
+        };
+
+    public:
+        static constexpr uint32_t MAGIC = 0x44425641;
+        static constexpr uint16_t VERSION = 1;
+
+        // records and removals buffered before they are written out
+        static constexpr size_t BATCH_SIZE = 1024;
+        static constexpr size_t CHECKPOINT_BUFFER_BYTES = 1 << 20;
+
+        // keys copied per lock hold by snapshot scans and by the reclaimer
+        static constexpr size_t SCAN_BATCH = 4096;
+        static constexpr size_t RECLAIM_BATCH = 4096;
+
+        // slot of keys which did not exist
+        static constexpr uint64_t ABSENT = std::numeric_limits<uint64_t>::max();
+
+        typedef struct CheckpointHeader {
+            CheckpointHeader()
+                : magic(MAGIC), version(VERSION), reserved(0), entrySize(0),
+                  count(0), watermark(0), generation(0), entriesChecksum(0), checksum(0) {}
+
+            uint32_t magic;
+            uint16_t version;
+            uint16_t reserved;
+            uint64_t entrySize;
+            uint64_t count;
+            uint64_t watermark;
+            uint64_t generation;
+            uint32_t entriesChecksum;
+            uint32_t checksum; // of every field above
+
+            uint32_t compute() const {
+                return CRC32C::compute(reinterpret_cast<const char*>(this), offsetof(CheckpointHeader, checksum));
+            }
+
+            operator const char*() const {
+                return reinterpret_cast<const char*>(this);
+            }
+
+            operator char*() {
+                return reinterpret_cast<char*>(this);
+            }
+        } CheckpointHeader;
+
+    private:
+        // what the database needs from a secondary index, whatever its field type
+        class SecondaryIndex {
+            public:
+                virtual ~SecondaryIndex() {}
+
+                virtual void insert(const Record& record, uint64_t slot) = 0;
+                virtual void remove(const Record& record, uint64_t slot) = 0;
+
+                // loads the checkpoint at path if it is the one of the given generation
+                virtual bool load(const std::string& path, uint64_t generation, uint64_t count) = 0;
+                virtual void save(const std::string& path, CheckpointHeader header) const = 0;
+        };
+
+    public:
+        // an index of the records by extractor(record), as (field, slot) pairs in order
+        template <typename S,
+                  class SLess = std::less<S>,
+                  class SSerializer = BinarySerializer<S>>
+        class Index : public SecondaryIndex {
+            private:
+                typedef std::pair<S, uint64_t> Entry;
+
+                // by field, then by slot so that records can share a field
+                struct EntryLess {
+                    bool operator()(const Entry& a, const Entry& b) const {
+                        SLess less;
+                        if (less(a.first, b.first))
+                            return true;
+                        if (less(b.first, a.first))
+                            return false;
+                        return a.second < b.second;
+                    }
+                };
+
+                std::function<S(const T&)> extractor;
+                AVLTree<Entry, EntryLess> tree;
+
+            public:
+                Index(std::function<S(const T&)> extractor) : extractor(extractor) {}
+
+                void insert(const Record& record, uint64_t slot) override {
+                    tree.insert(Entry(extractor(record.second), slot));
+                }
+
+                void remove(const Record& record, uint64_t slot) override {
+                    tree.remove(Entry(extractor(record.second), slot));
+                }
+
+                bool load(const std::string& path, uint64_t generation, uint64_t count) override {
+                    if (::access(path.c_str(), F_OK) != 0)
+                        return false;
+
+                    CheckpointHeader header;
+                    try {
+                        header = loadTree<PairSerializer<S, uint64_t, SSerializer>>(path, tree);
+                    } catch (const std::runtime_error&) { // rebuilt from the body instead
+                        header = CheckpointHeader();
+                    }
+                    if (header.generation == generation && header.count == count)
+                        return true;
+
+                    tree = AVLTree<Entry, EntryLess>();
+                    return false;
+                }
+
+                void save(const std::string& path, CheckpointHeader header) const override {
+                    saveTree<PairSerializer<S, uint64_t, SSerializer>>(path, tree, header);
+                }
+
+                friend AVLDatabase;
+        };
+
+        // a read only view of the table as of the version it was taken at, which can be
+        // read from any thread while the writer goes on. it is closed when destroyed
+        class Snapshot {
+            private:
+                AVLDatabase* db;
+                uint64_t stamp;
+
+            public:
+                Snapshot(AVLDatabase* db, uint64_t stamp) : db(db), stamp(stamp) {}
+
+                virtual ~Snapshot() {
+                    if (db != nullptr)
+                        db->close(stamp);
+                }
+
+                Snapshot(const Snapshot& other) = delete;
+                Snapshot& operator=(const Snapshot& other) = delete;
+
+                Snapshot(Snapshot&& other) : db(other.db), stamp(other.stamp) {
+                    other.db = nullptr;
+                }
+
+                uint64_t version() const {
+                    return stamp;
+                }
+
+                bool find(const K& key, T& data) const {
+                    uint64_t slot;
+                    {
+                        std::lock_guard<std::mutex> lock(db->mutex);
+                        auto it = db->tree.find(IndexEntry(key, 0));
+                        slot = db->slotAt(key, it == db->tree.cend() ? ABSENT : it->second, stamp);
+                        if (slot == ABSENT)
+                            return false;
+                        if (db->pending(slot)) {
+                            data = db->pendingRecords[slot - db->pendingStart].second;
+                            return true;
+                        }
+                    }
+
+                    data = db->body.read(slot).second;
+                    return true;
+                }
+
+                T at(const K& key) const {
+                    T data;
+                    if (!find(key, data))
+                        throw std::out_of_range("key not found");
+                    return data;
+                }
+
+                // visits every record in key order, as visitor(key, data). the keys are
+                // resolved SCAN_BATCH at a time under the lock, and their records read after
+                template <class Visitor>
+                void scan(Visitor visitor) const {
+                    Less less;
+                    K last = K();
+                    bool started = false, done = false;
+                    std::vector<Record> records;
+                    std::vector<size_t> slots, positions;
+
+                    while (!done) {
+                        records.clear();
+                        slots.clear();
+                        positions.clear();
+                        {
+                            std::lock_guard<std::mutex> lock(db->mutex);
+                            auto it = db->tree.cbegin();
+                            auto chain = db->chains.begin();
+                            if (started) {
+                                it = db->tree.lowerBound(IndexEntry(last, 0));
+                                if (it != db->tree.cend() && !less(last, it->first))
+                                    ++it;
+                                chain = db->chains.upper_bound(last);
+                            }
+
+                            // the keys of the tree and of the version chains, merged
+                            for (size_t n = 0; n < SCAN_BATCH && (it != db->tree.cend() || chain != db->chains.end()); n++) {
+                                bool inTree = it != db->tree.cend() && (chain == db->chains.end() || !less(chain->first, it->first));
+                                bool inChains = chain != db->chains.end() && (it == db->tree.cend() || !less(it->first, chain->first));
+                                last = inTree ? it->first : chain->first;
+                                started = true;
+
+                                uint64_t slot = db->slotAt(last, inTree ? it->second : ABSENT, stamp);
+                                if (inTree)
+                                    ++it;
+                                if (inChains)
+                                    ++chain;
+
+                                if (slot == ABSENT)
+                                    continue;
+                                if (db->pending(slot))
+                                    records.push_back(db->pendingRecords[slot - db->pendingStart]);
+                                else {
+                                    positions.push_back(records.size());
+                                    slots.push_back(slot);
+                                    records.emplace_back();
+                                }
+                            }
+                            done = it == db->tree.cend() && chain == db->chains.end();
+                        }
+
+                        if (!slots.empty()) {
+                            std::vector<Record> read = db->body.readBatch(slots);
+                            for (size_t i = 0; i < read.size(); i++)
+                                records[positions[i]] = std::move(read[i]);
+                        }
+                        for (const Record& r : records)
+                            visitor(r.first, r.second);
+                    }
+                }
+        };
+
+    private:
+        // decodes the entries of a mapped checkpoint, one at a time
+        template <typename Entry,
+                  class EntrySerializer_>
+        struct EntryReader {
+            const char* position;
+
+            Entry operator*() const {
+                return SerializerTraits<Entry, EntrySerializer_>::deserialize(position);
+            }
+
+            EntryReader& operator++() {
+                position += EntrySerializer_::size;
+                return *this;
+            }
+        };
+
+        std::string idxPath;
+        FileStorage<IndexEntry, EntrySerializer> removals;
+        FileStorage<Record, PairSerializer<K, T, KeySerializer, Serializer>> body;
+        AVLTree<IndexEntry, KeyLess> tree;
+        size_t count;
+
+        std::vector<std::pair<std::string, std::unique_ptr<SecondaryIndex>>> indexes;
+
+        // guards what snapshots read (the trees, version chains and pending records)
+        // against the writer. the writer itself only takes it to change them
+        mutable std::mutex mutex;
+        uint64_t version;
+        std::multiset<uint64_t> snapshots; // versions of the open snapshots
+        std::map<K, std::vector<std::pair<uint64_t, uint64_t>>, Less> chains; // key -> (version, slot before it)[]
+        bool reclaimRunning, reclaimAgain;
+        std::future<void> reclaiming;
+
+        uint64_t watermark;  // body size when the checkpoint was written
+        uint64_t generation; // of the checkpoint, so that stale removals are skipped
+        bool changed;        // since the checkpoint
+
+        // records and removals not yet written. the pending records go to the
+        // body slots starting at pendingStart
+        std::vector<Record> pendingRecords;
+        size_t pendingStart;
+        std::vector<IndexEntry> pendingRemovals;
+
+        void load() {
+            if (::access(idxPath.c_str(), F_OK) == 0) {
+                CheckpointHeader header = loadTree<EntrySerializer>(idxPath, tree);
+                count = header.count;
+                watermark = header.watermark;
+                generation = header.generation;
+            }
+
+            removals.scan(0, removals.size(), [this] (size_t, const IndexEntry& entry) {
+                if (entry.second != generation)
+                    return;
+                if (tree.remove(entry))
+                    count--;
+                changed = true;
+            });
+
+            body.scan(watermark, body.size(), [this] (size_t slot, const Record& record) {
+                auto it = tree.find(IndexEntry(record.first, slot));
+                if (it != tree.end())
+                    it->second = slot;
+                else {
+                    tree.insert(IndexEntry(record.first, slot));
+                    count++;
+                }
+                changed = true;
+            });
+
+            std::map<size_t, size_t> moves;
+            if (loadMoves(moves)) { // a rewrite crashed before its checkpoint
+                moveRecords(moves);
+                relocate(moves);
+                changed = true;
+                checkpoint();
+            }
+        }
+
+        // maps the checkpoint at path and bulk loads it into tree, returning its header
+        template <class EntrySerializer_,
+                  typename Entry,
+                  class EntryLess>
+        static CheckpointHeader loadTree(const std::string& path, AVLTree<Entry, EntryLess>& tree) {
+            File file(path);
+            CheckpointHeader header;
+            if (file.read(0, header, sizeof(CheckpointHeader)) < sizeof(CheckpointHeader) ||
+                header.magic != MAGIC)
+                throw std::runtime_error(path + " is not a database checkpoint");
+            if (header.version != VERSION)
+                throw std::runtime_error(path + " has unsupported format version " + std::to_string(header.version));
+            if (header.checksum != header.compute())
+                throw std::runtime_error("corrupt header in " + path);
+            if (header.entrySize != EntrySerializer_::size)
+                throw std::runtime_error(path + " holds keys of another type");
+            if (file.size() != sizeof(CheckpointHeader) + header.count * EntrySerializer_::size)
+                throw std::runtime_error(path + " is truncated");
+
+            if (header.count > 0) {
+                Mapping mapping(file, file.size());
+                mapping.advise(Access::SEQUENTIAL);
+                const char* entries = mapping.get() + sizeof(CheckpointHeader);
+                if (CRC32C::compute(entries, header.count * EntrySerializer_::size) != header.entriesChecksum)
+                    throw std::runtime_error("corrupt entries in " + path);
+
+                tree = AVLTree<Entry, EntryLess>::fromSorted(EntryReader<Entry, EntrySerializer_>{entries}, header.count);
+            }
+
+            return header;
+        }
 
-        void rewriteIndex();
-        void rewriteData();
+        // writes the entries of tree in order next to the checkpoint at path, then swaps them
+        template <class EntrySerializer_,
+                  typename Entry,
+                  class EntryLess>
+        static void saveTree(const std::string& path, const AVLTree<Entry, EntryLess>& tree, CheckpointHeader header) {
+            const std::string tmpPath = path + ".tmp";
+            header.entrySize = EntrySerializer_::size;
+            header.count = 0;
+
+            {
+                File file(tmpPath, O_RDWR | O_CREAT | O_TRUNC);
+                std::vector<char> buffer;
+                buffer.reserve(CHECKPOINT_BUFFER_BYTES + EntrySerializer_::size);
+                size_t offset = sizeof(CheckpointHeader);
+                uint32_t crc = 0;
+
+                auto drain = [&] () {
+                    crc = CRC32C::compute(buffer.data(), buffer.size(), crc);
+                    file.write(offset, buffer.data(), buffer.size());
+                    offset += buffer.size();
+                    buffer.clear();
+                };
+
+                for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
+                    buffer.resize(buffer.size() + EntrySerializer_::size);
+                    EntrySerializer_::serialize(*it, buffer.data() + buffer.size() - EntrySerializer_::size);
+                    header.count++;
+                    if (buffer.size() >= CHECKPOINT_BUFFER_BYTES)
+                        drain();
+                }
+                drain();
+
+                header.entriesChecksum = crc;
+                header.checksum = header.compute();
+                file.write(0, header, sizeof(CheckpointHeader));
+                file.sync();
+            }
+
+            if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("could not replace " + path + ": " + std::strerror(errno));
+        }
+
+        std::string movesPath() const {
+            return idxPath + ".moves";
+        }
+
+        // saves moves before any is made. a file torn by a crash fails its checksum,
+        // and is ignored like a missing one, since no record had moved yet
+        void saveMoves(const std::map<size_t, size_t>& moves) const {
+            std::vector<uint64_t> fields{generation, moves.size()};
+            for (const auto& moved : moves) {
+                fields.push_back(moved.first);
+                fields.push_back(moved.second);
+            }
+            const char* data = reinterpret_cast<const char*>(fields.data());
+            size_t n = fields.size() * sizeof(uint64_t);
+            uint32_t crc = CRC32C::compute(data, n);
+
+            File file(movesPath(), O_RDWR | O_CREAT | O_TRUNC);
+            file.write(0, data, n);
+            file.write(n, reinterpret_cast<const char*>(&crc), sizeof(crc));
+            file.sync();
+        }
+
+        // loads the moves of a rewrite that followed the current checkpoint, if any
+        bool loadMoves(std::map<size_t, size_t>& moves) const {
+            if (::access(movesPath().c_str(), F_OK) != 0)
+                return false;
+
+            File file(movesPath());
+            uint64_t head[2];
+            if (file.read(0, reinterpret_cast<char*>(head), sizeof(head)) < sizeof(head) ||
+                head[0] != generation ||
+                file.size() != sizeof(head) + head[1] * 2 * sizeof(uint64_t) + sizeof(uint32_t))
+                return false;
+
+            std::vector<uint64_t> fields(2 + head[1] * 2);
+            size_t n = fields.size() * sizeof(uint64_t);
+            uint32_t crc;
+            file.read(0, reinterpret_cast<char*>(fields.data()), n);
+            file.read(n, reinterpret_cast<char*>(&crc), sizeof(crc));
+            if (CRC32C::compute(reinterpret_cast<const char*>(fields.data()), n) != crc)
+                return false;
+
+            for (size_t i = 2; i < fields.size(); i += 2)
+                moves[fields[i]] = fields[i + 1];
+            return true;
+        }
+
+        // copies the records to their new slots, and frees the old ones once the copies
+        // are on disk. records already moved are skipped, so that moves can be redone
+        void moveRecords(const std::map<size_t, size_t>& moves) {
+            for (const auto& moved : moves) {
+                if (body.valid(moved.first))
+                    body.write(body.read(moved.first), moved.second);
+            }
+            body.sync();
+            for (const auto& moved : moves) {
+                if (body.valid(moved.first))
+                    body.remove(moved.first);
+            }
+        }
+
+        // maps the keys of the moved records to their new slots. moved records are
+        // always the latest of their keys, though after a crash the key may only have
+        // been known from body slots that the compaction cut off
+        void relocate(const std::map<size_t, size_t>& moves) {
+            for (const auto& moved : moves) {
+                Record r = body.read(moved.second);
+                auto it = tree.find(IndexEntry(r.first, 0));
+                if (it == tree.end()) {
+                    tree.insert(IndexEntry(r.first, moved.second));
+                    count++;
+                    continue;
+                }
+                for (auto& index : indexes) {
+                    index.second->remove(r, it->second);
+                    index.second->insert(r, moved.second);
+                }
+                it->second = moved.second;
+            }
+        }
+
+        // the slot key had at version v, given the one it has now
+        uint64_t slotAt(const K& key, uint64_t current, uint64_t v) const {
+            auto chain = chains.find(key);
+            if (chain == chains.end())
+                return current;
+            for (const auto& change : chain->second) {
+                if (change.first > v)
+                    return change.second;
+            }
+            return current;
+        }
+
+        // remembers the slot key had before this change, if a snapshot may need it
+        void remember(const K& key, uint64_t slot) {
+            version++;
+            if (!snapshots.empty())
+                chains[key].emplace_back(version, slot);
+        }
+
+        // drops the chain entries older than every open snapshot, a few keys at a
+        // time so that the writer is never held up for long. runs until nothing is left to do
+        void reclaim() {
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!reclaimAgain) {
+                        reclaimRunning = false;
+                        return;
+                    }
+                    reclaimAgain = false;
+                }
+
+                bool done = false;
+                K from = K();
+                for (bool first = true; !done; first = false) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    uint64_t oldest = snapshots.empty() ? std::numeric_limits<uint64_t>::max() : *snapshots.begin();
+                    auto it = first ? chains.begin() : chains.lower_bound(from);
+                    for (size_t n = 0; it != chains.end() && n < RECLAIM_BATCH; n++) {
+                        auto& chain = it->second;
+                        auto kept = std::find_if(chain.begin(), chain.end(),
+                                                 [oldest] (const std::pair<uint64_t, uint64_t>& c) { return c.first > oldest; });
+                        chain.erase(chain.begin(), kept);
+                        it = chain.empty() ? chains.erase(it) : std::next(it);
+                    }
+                    done = it == chains.end();
+                    if (!done)
+                        from = it->first;
+                }
+            }
+        }
+
+        void close(uint64_t stamp) {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshots.erase(snapshots.find(stamp));
+            reclaimAgain = true;
+            if (!reclaimRunning) {
+                reclaimRunning = true;
+                reclaiming = AsyncIO::shared().pool().submit([this] { reclaim(); });
+            }
+        }
+
+        std::string indexPath(const std::string& name) const {
+            return idxPath + "." + name;
+        }
+
+        bool pending(uint64_t slot) const {
+            return slot >= pendingStart && slot - pendingStart < pendingRecords.size();
+        }
+
+        Record record(uint64_t slot) const {
+            if (pending(slot))
+                return pendingRecords[slot - pendingStart];
+            return body.read(slot);
+        }
+
+        uint64_t append(const K& key, const T& data) {
+            if (pendingRecords.empty())
+                pendingStart = body.size();
+            pendingRecords.emplace_back(key, data);
+            uint64_t slot = pendingStart + pendingRecords.size() - 1;
+
+            if (pendingRecords.size() >= BATCH_SIZE)
+                flushRecords();
+            return slot;
+        }
+
+        // frees the slot, dropping its record from the secondary indexes
+        void release(uint64_t slot) {
+            if (!indexes.empty()) {
+                Record old = record(slot);
+                for (auto& index : indexes)
+                    index.second->remove(old, slot);
+            }
+
+            if (pending(slot))
+                flushRecords();
+            body.remove(slot);
+        }
+
+        void flushRecords() {
+            body.writeBatch(pendingStart, pendingRecords.begin(), pendingRecords.end());
+            pendingRecords.clear();
+        }
+
+        void flushRemovals() {
+            removals.writeBatch(removals.size(), pendingRemovals.begin(), pendingRemovals.end());
+            pendingRemovals.clear();
+        }
 
     public:
-        AVLDatabase(const std::string& idxPath, const std::string& dataPath) 
-            : index(idxPath), body(dataPath) 
-            {}
+        AVLDatabase(const std::string& idxPath, const std::string& dataPath)
+            : idxPath(idxPath), removals(idxPath + ".log"), body(dataPath), count(0), version(0),
+              reclaimRunning(false), reclaimAgain(false), watermark(0), generation(0), changed(false), pendingStart(0) {
+            load();
+        }
 
+        // every snapshot must be closed first
         virtual ~AVLDatabase() {
-            rewrite();
+            if (reclaiming.valid())
+                reclaiming.wait();
+            if (!dataClean())
+                rewrite();
+            else if (!indexClean())
+                checkpoint();
+        }
+
+        AVLDatabase(const AVLDatabase& other) = delete;
+        AVLDatabase& operator=(const AVLDatabase& other) = delete;
+
+        // registers an index on extractor(record), loaded from its checkpoint when that
+        // is up to date and built from the body otherwise
+        template <typename S,
+                  class SLess = std::less<S>,
+                  class SSerializer = BinarySerializer<S>>
+        Index<S, SLess, SSerializer>& addIndex(const std::string& name, std::function<S(const T&)> extractor) {
+            for (const auto& index : indexes) {
+                if (index.first == name)
+                    throw std::invalid_argument("index " + name + " already exists");
+            }
+
+            auto index = std::make_unique<Index<S, SLess, SSerializer>>(extractor);
+            if (changed || !index->load(indexPath(name), generation, count)) {
+                flush();
+                body.scan(0, body.size(), [this, &index] (size_t slot, const Record& record) {
+                    auto it = tree.find(IndexEntry(record.first, 0));
+                    if (it != tree.cend() && it->second == slot)
+                        index->insert(record, slot);
+                });
+                changed = true; // so that the index is checkpointed
+            }
+
+            Index<S, SLess, SSerializer>& ret = *index;
+            indexes.emplace_back(name, std::move(index));
+            return ret;
+        }
+
+        // the table as it is now, for readers on other threads
+        Snapshot snapshot() {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshots.insert(version);
+            return Snapshot(this, version);
         }
 
-        AVLDatabase(const AVLDatabase& other) {
+        // inserts a record, replacing the one stored under key if there is any
+        void insert(const K& key, const T& data) {
+            std::lock_guard<std::mutex> lock(mutex);
+            changed = true;
+            uint64_t slot = append(key, data);
+            for (auto& index : indexes)
+                index.second->insert(Record(key, data), slot);
+
+            auto it = tree.find(IndexEntry(key, 0));
+            if (it != tree.end()) {
+                uint64_t old = it->second;
+                remember(key, old);
+                it->second = slot;
+                release(old);
+                return;
+            }
 
+            remember(key, ABSENT);
+            tree.insert(IndexEntry(key, slot));
+            count++;
         }
 
-        AVLDatabase<T, Less>& operator=(AVLDatabase<T, Less> other) {
+        bool remove(const K& key) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = tree.find(IndexEntry(key, 0));
+            if (it == tree.end())
+                return false;
+
+            uint64_t slot = it->second;
+            remember(key, slot);
+            tree.remove(IndexEntry(key, slot));
+            count--;
+            release(slot);
+            changed = true;
 
+            pendingRemovals.emplace_back(key, generation);
+            if (pendingRemovals.size() >= BATCH_SIZE)
+                flushRemovals();
+            return true;
         }
 
-        AVLDatabase(AVLDatabase&& other) {
+        bool find(const K& key, T& data) const {
+            auto it = tree.find(IndexEntry(key, 0));
+            if (it == tree.cend())
+                return false;
 
+            data = record(it->second).second;
+            return true;
         }
 
-        void insert(const T& data) {
+        T at(const K& key) const {
+            T data;
+            if (!find(key, data))
+                throw std::out_of_range("key not found");
+            return data;
+        }
 
+        bool containsKey(const K& key) const {
+            return tree.find(IndexEntry(key, 0)) != tree.cend();
         }
 
-        bool remove(const T& data) {
+        // visits the records with from <= field < to in field order, as visitor(key, data)
+        template <typename S,
+                  class SLess,
+                  class SSerializer,
+                  class Visitor>
+        void range(const Index<S, SLess, SSerializer>& index, const S& from, const S& to, Visitor visitor) const {
+            SLess less;
+            auto it = index.tree.lowerBound(typename Index<S, SLess, SSerializer>::Entry(from, 0));
+            for (; it != index.tree.cend() && less(it->first, to); ++it) {
+                Record r = record(it->second);
+                visitor(r.first, r.second);
+            }
+        }
 
+        // visits the records whose field is equivalent to value, as visitor(key, data)
+        template <typename S,
+                  class SLess,
+                  class SSerializer,
+                  class Visitor>
+        void findBy(const Index<S, SLess, SSerializer>& index, const S& value, Visitor visitor) const {
+            SLess less;
+            auto it = index.tree.lowerBound(typename Index<S, SLess, SSerializer>::Entry(value, 0));
+            for (; it != index.tree.cend() && !less(value, it->first); ++it) {
+                Record r = record(it->second);
+                visitor(r.first, r.second);
+            }
         }
 
+        // writes every buffered change to the body and the removal log
+        void flush() {
+            std::lock_guard<std::mutex> lock(mutex);
+            flushRecords();
+            flushRemovals();
+            removals.flush();
+            body.flush();
+        }
+
+        // checkpoints the primary and secondary indexes, so that the next open replays nothing.
+        // the primary checkpoint goes last, as the others are only used if they match it
+        void checkpoint() {
+            flush();
+            body.sync();
+
+            CheckpointHeader header;
+            header.watermark = body.size();
+            header.generation = generation + 1;
+            for (const auto& index : indexes)
+                index.second->save(indexPath(index.first), header);
+            saveTree<EntrySerializer>(idxPath, tree, header);
+
+            watermark = header.watermark;
+            generation = header.generation;
+            removals.truncate(0);
+            std::remove(movesPath().c_str()); // the checkpoint holds them now
+            changed = false;
+        }
+
+        // compacts the body, remapping the moved records, then checkpoints the indexes.
+        // the moves are saved first, so that they are redone if the checkpoint is not.
+        // freed slots may still be read by snapshots, so only checkpoints while any is open
         void rewrite() {
+            flush();
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!snapshots.empty()) {
+                lock.unlock();
+                checkpoint();
+                return;
+            }
+
+            std::map<size_t, size_t> moves = body.relocations(std::numeric_limits<size_t>::max());
+            if (!moves.empty())
+                saveMoves(moves);
+            moveRecords(moves);
+            relocate(moves);
+            relocate(body.rewrite()); // only drops the holes left at the end
 
+            lock.unlock();
+            checkpoint();
         }
 
-        bool dataClean() {
-            return isDataClean;
+        // whether the body has no holes left by removed or replaced records
+        bool dataClean() const {
+            return body.freeCount() == 0;
         }
 
-        bool indexClean() {
-            return isIndexClean;
+        // whether the checkpoint holds every change
+        bool indexClean() const {
+            return !changed;
         }
 
-        bool clean() {
+        bool clean() const {
             return indexClean() && dataClean();
         }
 
         bool empty() const {
+            return count == 0;
+        }
 
+        size_t size() const {
+            return count;
         }
 
         int height() const {
-
+            return tree.height();
         }
 
-        template <typename U>
-        friend std::ostream& operator<<(std::ostream& os, const AVLDatabase<U>& t);
+        template <typename K2, typename T2, class L2, class KS2, class S2>
+        friend std::ostream& operator<<(std::ostream& os, const AVLDatabase<K2, T2, L2, KS2, S2>& d);
 };
 
-#endif
\ No newline at end of file
+template <typename K, typename T, class Less, class KeySerializer, class Serializer>
+std::ostream& operator<<(std::ostream& os, const AVLDatabase<K, T, Less, KeySerializer, Serializer>& d) {
+    os << "[";
+    for (auto it = d.tree.cbegin(); it != d.tree.cend(); ++it)
+        os << "(" << it->first << ":" << d.at(it->first) << ")";
+    os << "]";
+
+    return os;
+}
+
+#endif
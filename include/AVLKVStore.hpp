@@ -18,12 +18,32 @@ class AVLKVStore {
         class KeyLess {
             public:
                 bool operator()(const KVPair& a, const KVPair& b) const {
-                    return a.first < b.first;
+                    return Less()(a.first, b.first);
                 }
         };
 
         AVLTree<KVPair, KeyLess> tree;
 
+        // reads (key, value) pairs as tree entries, moving the values out of rvalues
+        template <typename InputIt>
+        class SortedReader {
+            protected:
+                InputIt it;
+
+            public:
+                SortedReader(InputIt it) : it(it) {};
+
+                KVPair operator*() {
+                    auto&& p = *it;
+                    return KVPair(p.first, std::make_shared<V>(std::forward<decltype(p)>(p).second));
+                }
+
+                SortedReader& operator++() {
+                    ++it;
+                    return *this;
+                }
+        };
+
     public:
         typedef typename AVLTree<KVPair, KeyLess>::const_iterator const_iterator;
         typedef typename AVLTree<KVPair, KeyLess>::iterator iterator;
@@ -105,6 +125,10 @@ class AVLKVStore {
         iterator begin();
         iterator end();
 
+        // builds a balanced store out of n (key, value) pairs in increasing key order, in O(n)
+        template <typename InputIt>
+        static AVLKVStore fromSorted(InputIt first, size_t n);
+
         // AVLKVStore();
         // AVLKVStore(const AVLKVStore& other);
         // AVLKVStore& operator=(const AVLKVStore& other);
@@ -116,6 +140,12 @@ class AVLKVStore {
 
         V& operator[](const K& key);
         const V& at(const K& key) const;
+        // nullptr if there is no such key; one descent, unlike containsKey and then at
+        const V* find(const K& key) const;
+        V* find(const K& key);
+
+        // the first pair whose key is not less than key, or cend()
+        const_iterator lowerBound(const K& key) const;
         bool containsKey(const K& key) const;
 
         bool empty() const;
@@ -124,9 +154,21 @@ class AVLKVStore {
         friend std::ostream& operator<<(std::ostream& os, const AVLKVStore<L, B>& d);
 };
 
+template <typename K, typename V, class Less>
+template <typename InputIt>
+AVLKVStore<K, V, Less> AVLKVStore<K, V, Less>::fromSorted(InputIt first, size_t n) {
+    AVLKVStore<K, V, Less> store;
+    store.tree = AVLTree<KVPair, KeyLess>::fromSorted(SortedReader<InputIt>(first), n);
+    return store;
+}
+
 template <typename K, typename V, class Less>
 void AVLKVStore<K, V, Less>::insert(K key, const V& value) {
-    tree.insert(KVPair(key, std::shared_ptr<V>(new V(value))));
+    const KVPair* found = tree.lookup(KVPair(key, nullptr));
+    if (found != nullptr)
+        *found->second = value;
+    else
+        tree.insert(KVPair(key, std::shared_ptr<V>(new V(value))));
 }
 
 template <typename K, typename V, class Less>
@@ -150,7 +192,7 @@ void AVLKVStore<K, V, Less>::foreach(std::function<void(const V&)> operation) {
 
 template <typename K, typename V, class Less>
 bool AVLKVStore<K, V, Less>::containsKey(const K& key) const {
-    return tree.find(KVPair(key, nullptr)) != tree.cend();
+    return tree.lookup(KVPair(key, nullptr)) != nullptr;
 }
 
 template <typename K, typename V, class Less>
@@ -160,20 +202,38 @@ bool AVLKVStore<K, V, Less>::empty() const {
 
 template <typename K, typename V, class Less>
 V& AVLKVStore<K, V, Less>::operator[](const K& key) {
-    auto it = tree.find(KVPair(key, nullptr));
-    if (it == tree.end()) {
-        tree.insert(KVPair(key, std::shared_ptr<V>(new V()))); // TODO: optimize
-        it = tree.find(KVPair(key, nullptr));
-    }
-    return *it->second;
+    const KVPair* found = tree.lookup(KVPair(key, nullptr));
+    if (found != nullptr)
+        return *found->second;
+
+    std::shared_ptr<V> value(new V());
+    tree.insert(KVPair(key, value));
+    return *value;
 }
 
 template <typename K, typename V, class Less>
 const V& AVLKVStore<K, V, Less>::at(const K& key) const {
-    auto it = tree.find(KVPair(key, nullptr));
-    if (it == tree.cend())
+    const KVPair* found = tree.lookup(KVPair(key, nullptr));
+    if (found == nullptr)
         throw std::invalid_argument("no key named "+key);
-    return *it->second;
+    return *found->second;
+}
+
+template <typename K, typename V, class Less>
+const V* AVLKVStore<K, V, Less>::find(const K& key) const {
+    const KVPair* found = tree.lookup(KVPair(key, nullptr));
+    return found != nullptr ? found->second.get() : nullptr;
+}
+
+template <typename K, typename V, class Less>
+V* AVLKVStore<K, V, Less>::find(const K& key) {
+    const KVPair* found = tree.lookup(KVPair(key, nullptr));
+    return found != nullptr ? found->second.get() : nullptr;
+}
+
+template <typename K, typename V, class Less>
+typename AVLKVStore<K, V, Less>::const_iterator AVLKVStore<K, V, Less>::lowerBound(const K& key) const {
+    return tree.lowerBound(KVPair(key, nullptr));
 }
 
 template <typename K, typename V, class Less>
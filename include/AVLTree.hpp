@@ -32,7 +32,11 @@ class AVLTree {
         virtual ~AVLTree();
         AVLTree(const AVLTree& other);
         AVLTree<T, Less>& operator=(AVLTree<T, Less> other);
-        AVLTree(AVLTree&& other);
+        AVLTree(AVLTree&& other) noexcept;
+
+        // builds a balanced tree out of n elements in increasing order, in O(n)
+        template <typename InputIt>
+        static AVLTree<T, Less> fromSorted(InputIt first, size_t n);
 
         void insert(const T& data);
         bool remove(const T& data);
@@ -42,6 +46,12 @@ class AVLTree {
         const_iterator find(const T& data) const;
         iterator find(const T& data);
 
+        // the first element not less than data, or cend()
+        const_iterator lowerBound(const T& data) const;
+
+        // the element equal to data, or nullptr, without building an iterator
+        const T* lookup(const T& data) const;
+
         int height() const;
         const_iterator cbegin() const;
         const_iterator cend() const;
@@ -68,20 +78,38 @@ AVLTree<T, Less>::~AVLTree() {
 }
 
 template <typename T, class Less>
-AVLTree<T, Less>::AVLTree(const AVLTree<T, Less>& other) {
-    if (other.root != nullptr)
+AVLTree<T, Less>::AVLTree(const AVLTree<T, Less>& other) : root(nullptr) {
+    if (other.root != nullptr) {
         root = new AVLTreeNode<T, Less>(*other.root);
+        root->parentPtr = &root;
+    }
 };
 
 template <typename T, class Less>
 AVLTree<T, Less>& AVLTree<T, Less>::operator=(AVLTree<T, Less> other) {
     std::swap(root, other.root);
+    if (root != nullptr)
+        root->parentPtr = &root;
+    if (other.root != nullptr)
+        other.root->parentPtr = &other.root;
 
     return *this;
 }
 
 template <typename T, class Less>
-AVLTree<T, Less>::AVLTree(AVLTree&& other) : root(std::move(other.root)) {}
+AVLTree<T, Less>::AVLTree(AVLTree&& other) noexcept : root(other.root) {
+    other.root = nullptr;
+    if (root != nullptr)
+        root->parentPtr = &root;
+}
+
+template <typename T, class Less>
+template <typename InputIt>
+AVLTree<T, Less> AVLTree<T, Less>::fromSorted(InputIt first, size_t n) {
+    AVLTree<T, Less> tree;
+    AVLTreeNode<T, Less>::build(first, n, tree.root);
+    return tree;
+}
 
 
 template <typename T, class Less>
@@ -158,6 +186,20 @@ typename AVLTree<T, Less>::const_iterator AVLTree<T, Less>::find(const T& data)
     return AVLTree<T, Less>::downcastIterator(const_cast<const AVLTreeNode<T, Less>*>(root)->find(data));
 }
 
+template <typename T, class Less>
+typename AVLTree<T, Less>::const_iterator AVLTree<T, Less>::lowerBound(const T& data) const {
+    if (root == nullptr)
+        return cend();
+    return AVLTree<T, Less>::downcastIterator(const_cast<const AVLTreeNode<T, Less>*>(root)->lowerBound(data));
+}
+
+template <typename T, class Less>
+const T* AVLTree<T, Less>::lookup(const T& data) const {
+    if (root == nullptr)
+        return nullptr;
+    return root->lookup(data);
+}
+
 template <typename T, class Less>
 int AVLTree<T, Less>::height() const {
     if (root == nullptr)
@@ -10,6 +10,9 @@
 
 #include "useful.hpp"
 
+template <typename T, class Less>
+class AVLTree;
+
 template <typename T,
           class Less = std::less<T>>
 class AVLTreeNode {
@@ -167,6 +170,11 @@ class AVLTreeNode {
         AVLTreeNode<T, Less>& operator= (AVLTreeNode<T, Less> other);
         AVLTreeNode(AVLTreeNode&& other);
 
+        // builds a balanced subtree at ptr out of the next n elements of first,
+        // which must be in increasing order
+        template <typename InputIt>
+        static void build(InputIt& first, size_t n, AVLTreeNode<T, Less>*& ptr);
+
         bool isLeaf();
 
         unsigned int height();
@@ -178,6 +186,12 @@ class AVLTreeNode {
         const_iterator find(const T& data) const;
         iterator find(const T& data);
 
+        // the first element not less than data
+        const_iterator lowerBound(const T& data) const;
+
+        // the element equal to data, or nullptr, in one descent without an iterator
+        const T* lookup(const T& data) const;
+
         const_iterator cbegin() const;
         const_iterator cend() const;
 
@@ -214,6 +228,8 @@ class AVLTreeNode {
 
     template <typename U, class L>
     friend void swap(AVLTreeNode<U, L>& a, AVLTreeNode<U, L>& b);
+
+    friend class AVLTree<T, Less>;
 };
 
 template <typename T, class Less>
@@ -238,11 +254,16 @@ AVLTreeNode<T, Less>::~AVLTreeNode() {
 }
 
 template <typename T, class Less>
-AVLTreeNode<T, Less>::AVLTreeNode(const AVLTreeNode& other) : data(other.data), parentPtr(other.parentPtr) {
-    if (other.right != nullptr)
+AVLTreeNode<T, Less>::AVLTreeNode(const AVLTreeNode& other)
+    : parentPtr(other.parentPtr), left(nullptr), right(nullptr), data(other.data), lastHeight(other.lastHeight) {
+    if (other.right != nullptr) {
         right = new AVLTreeNode(*other.right);
-    if (other.left != nullptr)
+        right->parentPtr = &right;
+    }
+    if (other.left != nullptr) {
         left = new AVLTreeNode(*other.left);
+        left->parentPtr = &left;
+    }
 }
 
 template <typename T, class Less>
@@ -260,6 +281,26 @@ AVLTreeNode<T, Less>::AVLTreeNode(AVLTreeNode&& other)
       parentPtr(std::move(other.parentPtr))
       {}
 
+template <typename T, class Less>
+template <typename InputIt>
+void AVLTreeNode<T, Less>::build(InputIt& first, size_t n, AVLTreeNode<T, Less>*& ptr) {
+    if (n == 0)
+        return;
+
+    // in order, so that first is only read forward
+    AVLTreeNode<T, Less>* l = nullptr;
+    build(first, n / 2, l);
+
+    ptr = new AVLTreeNode<T, Less>(*first, ptr);
+    ++first;
+    ptr->left = l;
+    if (l != nullptr)
+        l->parentPtr = &ptr->left;
+
+    build(first, n - n / 2 - 1, ptr->right);
+    ptr->recalcHeight();
+}
+
 template <typename T, class Less>
 typename AVLTreeNode<T, Less>::const_iterator AVLTreeNode<T, Less>::cbegin() const {
     return AVLTreeNode<T, Less>::const_iterator(*this);
@@ -319,7 +360,7 @@ bool AVLTreeNode<T, Less>::remove(const T& data) {
     if (left != nullptr && right != nullptr) { // has both children
         AVLTreeNode<T, Less>& next = right->findMin();
         this->data = next.data;
-        next.remove(next.data);
+        right->remove(next.data); // from right, so that the path down to next is rebalanced
         recalcHeight();
         balance();
         return true;
@@ -358,8 +399,9 @@ typename AVLTreeNode<T, Less>::iterator AVLTreeNode<T, Less>::find(const T& data
 template <typename T, class Less>
 typename AVLTreeNode<T, Less>::const_iterator AVLTreeNode<T, Less>::find
     (const T& data, typename AVLTreeNode<T, Less>::const_iterator& it) const {
-    it.s.push(const_cast<AVLTreeNode<T, Less>*>(this));
     int comp = this->comparison(data, this->data);
+    if (comp <= 0) // nodes passed on the right are already visited in order
+        it.s.push(const_cast<AVLTreeNode<T, Less>*>(this));
     if (comp == 0)
         return it;
 
@@ -375,6 +417,33 @@ typename AVLTreeNode<T, Less>::const_iterator AVLTreeNode<T, Less>::find
         return ptr->find(data, it);
 }
 
+template <typename T, class Less>
+const T* AVLTreeNode<T, Less>::lookup(const T& data) const {
+    const AVLTreeNode<T, Less>* current = this;
+    while (current != nullptr) {
+        int comp = comparison(data, current->data);
+        if (comp == 0)
+            return &current->data;
+        current = comp < 0 ? current->left : current->right;
+    }
+    return nullptr;
+}
+
+template <typename T, class Less>
+typename AVLTreeNode<T, Less>::const_iterator AVLTreeNode<T, Less>::lowerBound(const T& data) const {
+    const_iterator it = cend();
+    const AVLTreeNode<T, Less>* current = this;
+    while (current != nullptr) {
+        if (comparison(current->data, data) < 0)
+            current = current->right;
+        else {
+            it.s.push(const_cast<AVLTreeNode<T, Less>*>(current));
+            current = current->left;
+        }
+    }
+    return it;
+}
+
 template <typename T, class Less>
 AVLTreeNode<T, Less>& AVLTreeNode<T, Less>::findMin() {
     AVLTreeNode<T, Less>* current = this;
@@ -471,6 +540,10 @@ void AVLTreeNode<T, Less>::rRotate() {
     right->parentPtr = &right;
     if (left != nullptr)
         left->parentPtr = &left;
+    if (tmp.left != nullptr) // tmp took other children, which must point back into it
+        tmp.left->parentPtr = &tmp.left;
+    if (tmp.right != nullptr)
+        tmp.right->parentPtr = &tmp.right;
 
     tmp.recalcHeight();
     recalcHeight();
@@ -486,6 +559,10 @@ void AVLTreeNode<T, Less>::lRotate() {
     left->parentPtr = &left;
     if (right != nullptr)
         right->parentPtr = &right;
+    if (tmp.left != nullptr)
+        tmp.left->parentPtr = &tmp.left;
+    if (tmp.right != nullptr)
+        tmp.right->parentPtr = &tmp.right;
 
     tmp.recalcHeight();
     recalcHeight();
@@ -0,0 +1,382 @@
+#ifndef ASYNCIO_INCLUDED
+#define ASYNCIO_INCLUDED
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <cerrno>
+#include <cstring>
+
+#include "FileIO.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>) && !defined(ASYNCIO_NO_IO_URING)
+#define ASYNCIO_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// A positioned read or write of length bytes between buffer and the file
+struct IORequest {
+    IORequest(char* buffer, size_t offset, size_t length, bool write = false)
+        : buffer(buffer), offset(offset), length(length), write(write) {}
+
+    char* buffer;
+    size_t offset;
+    size_t length;
+    bool write;
+};
+
+class IOThreadPool {
+    public:
+        IOThreadPool(size_t threads = std::max(4u, std::thread::hardware_concurrency())) : stopping(false) {
+            for (size_t i = 0; i < threads; i++)
+                workers.emplace_back([this] { work(); });
+        }
+
+        virtual ~IOThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& worker : workers)
+                worker.join();
+        }
+
+        IOThreadPool(const IOThreadPool& other) = delete;
+        IOThreadPool& operator=(const IOThreadPool& other) = delete;
+
+        size_t size() const {
+            return workers.size();
+        }
+
+        template <typename F>
+        auto submit(F task) -> std::future<decltype(task())> {
+            auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+            std::future<decltype(task())> ret = packaged->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push([packaged] { (*packaged)(); });
+            }
+            wake.notify_one();
+            return ret;
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+
+        void work() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (stopping && tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+            }
+        }
+};
+
+#ifdef ASYNCIO_IO_URING
+// Minimal io_uring submission/completion loop, talking to the kernel directly
+class IORing {
+    public:
+        IORing(unsigned entries = 64) : ringFd(-1) {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            ringFd = ::syscall(__NR_io_uring_setup, entries, &params);
+            if (ringFd < 0) // kernel too old or io_uring disabled
+                return;
+
+            sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                sqSize = cqSize = std::max(sqSize, cqSize);
+
+            sq = map(sqSize, IORING_OFF_SQ_RING);
+            cq = params.features & IORING_FEAT_SINGLE_MMAP ? sq : map(cqSize, IORING_OFF_CQ_RING);
+            sqes = static_cast<io_uring_sqe*>(map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+            if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+                ::close(ringFd);
+                ringFd = -1;
+                return;
+            }
+
+            sqTail = reinterpret_cast<unsigned*>(static_cast<char*>(sq) + params.sq_off.tail);
+            sqMask = *reinterpret_cast<unsigned*>(static_cast<char*>(sq) + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(static_cast<char*>(sq) + params.sq_off.array);
+            cqHead = reinterpret_cast<unsigned*>(static_cast<char*>(cq) + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(static_cast<char*>(cq) + params.cq_off.tail);
+            cqMask = *reinterpret_cast<unsigned*>(static_cast<char*>(cq) + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cq) + params.cq_off.cqes);
+            capacity = params.sq_entries;
+        }
+
+        virtual ~IORing() {
+            if (ringFd < 0)
+                return;
+
+            ::munmap(sqes, capacity * sizeof(io_uring_sqe));
+            if (cq != sq)
+                ::munmap(cq, cqSize);
+            ::munmap(sq, sqSize);
+            ::close(ringFd);
+        }
+
+        IORing(const IORing& other) = delete;
+        IORing& operator=(const IORing& other) = delete;
+
+        bool available() const {
+            return ringFd >= 0;
+        }
+
+        // runs every request, keeping up to capacity of them in flight, and
+        // returns how many bytes each one transferred. the kernel writes into the
+        // buffers and vectors until a request completes, so on failure nothing more
+        // is submitted and the first error is only thrown once every request in flight is reaped
+        std::vector<size_t> run(int fd, std::vector<IORequest>& requests) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<size_t> done(requests.size(), 0);
+            std::vector<iovec> vectors(requests.size());
+
+            std::string error;
+            size_t submitted = 0, completed = 0;
+            unsigned queued = 0; // in the submission queue, not taken by the kernel yet
+            while (completed < submitted || (error.empty() && submitted < requests.size())) {
+                unsigned tail = *sqTail;
+                while (error.empty() && submitted < requests.size() && submitted - completed < capacity) {
+                    IORequest& r = requests[submitted];
+                    vectors[submitted].iov_base = r.buffer;
+                    vectors[submitted].iov_len = r.length;
+
+                    unsigned index = tail & sqMask;
+                    io_uring_sqe& sqe = sqes[index];
+                    std::memset(&sqe, 0, sizeof(sqe));
+                    sqe.opcode = r.write ? IORING_OP_WRITEV : IORING_OP_READV;
+                    sqe.fd = fd;
+                    sqe.off = r.offset;
+                    sqe.addr = reinterpret_cast<unsigned long>(&vectors[submitted]);
+                    sqe.len = 1;
+                    sqe.user_data = submitted;
+                    sqArray[index] = index;
+
+                    tail++;
+                    submitted++;
+                    queued++;
+                }
+                __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+                // interrupted or busy calls are retried with whatever is still queued
+                long entered = ::syscall(__NR_io_uring_enter, ringFd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (entered >= 0)
+                    queued -= entered;
+                else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    if (error.empty())
+                        error = std::string("io_uring_enter failed: ") + std::strerror(errno);
+                    // a failed call takes no request, so the queued ones are withdrawn, and
+                    // those in flight are polled for until they complete
+                    __atomic_store_n(sqTail, tail - queued, __ATOMIC_RELEASE);
+                    submitted -= queued;
+                    queued = 0;
+                    std::this_thread::yield();
+                }
+
+                unsigned head = *cqHead;
+                while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                    io_uring_cqe& cqe = cqes[head & cqMask];
+                    if (cqe.res >= 0)
+                        done[cqe.user_data] = cqe.res;
+                    else if (error.empty())
+                        error = std::string("asynchronous I/O failed: ") + std::strerror(-cqe.res);
+                    head++;
+                    completed++;
+                }
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            }
+
+            if (!error.empty())
+                throw std::runtime_error(error);
+            return done;
+        }
+
+    private:
+        int ringFd;
+        std::mutex mutex;
+
+        void* sq;
+        void* cq;
+        size_t sqSize, cqSize;
+        io_uring_sqe* sqes;
+        unsigned* sqTail;
+        unsigned* sqArray;
+        unsigned sqMask;
+        unsigned* cqHead;
+        unsigned* cqTail;
+        unsigned cqMask;
+        io_uring_cqe* cqes;
+        unsigned capacity;
+
+        void* map(size_t length, off_t offset) {
+            return ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        }
+};
+#endif
+
+// Runs batches of positioned requests with many of them in flight, on
+// io_uring when the kernel allows it and on a thread pool otherwise
+class AsyncIO {
+    public:
+        // process wide instance, so that every storage shares the same threads and ring
+        static AsyncIO& shared() {
+            static AsyncIO instance;
+            return instance;
+        }
+
+        IOThreadPool& pool() {
+            return threads;
+        }
+
+        bool usingRing() const {
+#ifdef ASYNCIO_IO_URING
+            return ring.available();
+#else
+            return false;
+#endif
+        }
+
+        // blocks until every request is done. short transfers are finished
+        // synchronously, and reads past the end of the file are zero filled
+        void run(File& file, std::vector<IORequest>& requests) {
+            execute(file, &file, requests);
+        }
+
+        // same as above, for batches of reads only
+        void run(const File& file, std::vector<IORequest>& requests) {
+            execute(file, nullptr, requests);
+        }
+
+    private:
+        IOThreadPool threads;
+#ifdef ASYNCIO_IO_URING
+        IORing ring;
+#endif
+
+        void execute(const File& file, File* writable, std::vector<IORequest>& requests) {
+            if (requests.empty())
+                return;
+            if (writable == nullptr && std::any_of(requests.begin(), requests.end(), [] (const IORequest& r) { return r.write; }))
+                throw std::logic_error("writes need a writable file");
+
+            std::vector<size_t> done(requests.size(), 0);
+#ifdef ASYNCIO_IO_URING
+            if (ring.available())
+                done = ring.run(file.descriptor(), requests);
+            else
+#endif
+                done = runOnPool(file, writable, requests);
+
+            for (size_t i = 0; i < requests.size(); i++) {
+                IORequest& r = requests[i];
+                if (done[i] >= r.length)
+                    continue;
+                if (r.write)
+                    writable->write(r.offset + done[i], r.buffer + done[i], r.length - done[i]);
+                else {
+                    size_t n = done[i] + file.read(r.offset + done[i], r.buffer + done[i], r.length - done[i]);
+                    std::fill(r.buffer + n, r.buffer + r.length, 0);
+                }
+            }
+        }
+
+        // a batch shared with the helpers of runOnPool. helpers that start after the
+        // caller is done find it closed and return without touching the caller's locals
+        struct PoolBatch {
+            const File* file;
+            File* writable;
+            std::vector<IORequest>* requests;
+            std::vector<size_t>* done;
+            std::atomic<size_t> next{0};
+
+            std::mutex mutex;
+            std::condition_variable idle;
+            size_t active = 0;
+            bool closed = false;
+            std::exception_ptr error;
+
+            // takes requests until none is left, stopping every taker at the first failure
+            void work() {
+                for (size_t i = next++; i < requests->size(); i = next++) {
+                    IORequest& r = (*requests)[i];
+                    try {
+                        if (r.write) {
+                            writable->write(r.offset, r.buffer, r.length);
+                            (*done)[i] = r.length;
+                        }
+                        else
+                            (*done)[i] = file->read(r.offset, r.buffer, r.length);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error)
+                            error = std::current_exception();
+                        next = requests->size();
+                    }
+                }
+            }
+        };
+
+        // the caller works through the batch too, and only waits for the helpers that
+        // started, so that tasks running on the pool can do batch I/O without deadlocking it
+        std::vector<size_t> runOnPool(const File& file, File* writable, std::vector<IORequest>& requests) {
+            std::vector<size_t> done(requests.size(), 0);
+            auto batch = std::make_shared<PoolBatch>();
+            batch->file = &file;
+            batch->writable = writable;
+            batch->requests = &requests;
+            batch->done = &done;
+
+            size_t helpers = std::min(threads.size(), requests.size()) - 1;
+            for (size_t h = 0; h < helpers; h++) {
+                threads.submit([batch] {
+                    {
+                        std::lock_guard<std::mutex> lock(batch->mutex);
+                        if (batch->closed)
+                            return;
+                        batch->active++;
+                    }
+                    batch->work();
+
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    if (--batch->active == 0)
+                        batch->idle.notify_all();
+                });
+            }
+            batch->work();
+
+            std::unique_lock<std::mutex> lock(batch->mutex);
+            batch->closed = true;
+            batch->idle.wait(lock, [&batch] { return batch->active == 0; });
+            if (batch->error)
+                std::rethrow_exception(batch->error);
+            return done;
+        }
+};
+
+#endif
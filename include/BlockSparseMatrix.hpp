@@ -0,0 +1,518 @@
+#ifndef BLOCK_SPARSE_MATRIX_INCLUDED
+#define BLOCK_SPARSE_MATRIX_INCLUDED
+
+#include <iostream>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+#include "SparseMatrix.hpp"
+
+#if defined(__AVX2__)
+#define BLOCKSPARSEMATRIX_AVX2
+#include <immintrin.h>
+#endif
+
+/* A sparse matrix for clustered data, which stores B x B tiles of cells instead of
+   single cells. a tile is kept while any of its cells differs from the default value,
+   and holds all of them densely, row by row, so that a cluster costs one tree node per
+   tile rather than per cell. cells are read and written as in SparseMatrix.
+
+   freeze packs the tiles into block compressed rows (BSR), over rows of tiles:
+
+       offsets   (size_t)[block rows + 1]  tiles of block row i lie in [offsets[i], offsets[i + 1])
+       indices   (size_t)[tiles]           block column of each tile, ascending per block row
+       values    (T)[tiles * B * B]        cells of each tile, row by row
+
+   products run over frozen matrices a tile at a time, and take the default value as
+   zero. tiles at the right and bottom edges may reach past the matrix, their cells
+   there keeping the default value */
+template <typename T, size_t B = 4>
+class BlockSparseMatrix {
+    static_assert(B > 0, "tiles need at least one cell");
+
+    public:
+        enum Layout {
+            TREES,
+            BSR
+        };
+
+        typedef typename SparseMatrix<T>::Triplet Triplet;
+
+        static constexpr size_t CELLS = B * B;
+
+    protected:
+        struct Tile {
+            T cells[CELLS];
+            size_t filled; // cells differing from the default value
+
+            Tile() : filled(0) {};
+
+            explicit Tile(const T& value) : filled(0) {
+                std::fill(cells, cells + CELLS, value);
+            };
+        };
+
+        T defaultValue;
+
+        size_t _width, _height;
+
+        typedef AVLKVStore<size_t, Tile> BlockCols;
+        typedef AVLKVStore<size_t, BlockCols> BlockRows;
+
+        BlockRows rows;
+
+        Layout _layout;
+        std::vector<size_t> offsets;
+        std::vector<size_t> indices;
+        std::vector<T> values;
+
+        void checkMutable() const {
+            if (_layout != TREES)
+                throw std::logic_error("matrix is frozen");
+        }
+
+        static size_t blocksOf(size_t cells) {
+            return (cells + B - 1) / B;
+        }
+
+        static size_t cellOf(size_t y, size_t x) {
+            return y % B * B + x % B;
+        }
+
+        // cells of the tile at block (by, bx), or nullptr
+        const T* tileOf(size_t by, size_t bx) const {
+            if (_layout != TREES) {
+                if (by + 1 >= offsets.size())
+                    return nullptr;
+                const size_t* first = indices.data() + offsets[by];
+                const size_t* last = indices.data() + offsets[by + 1];
+                const size_t* it = std::lower_bound(first, last, bx);
+                if (it == last || *it != bx)
+                    return nullptr;
+                return values.data() + static_cast<size_t>(it - indices.data()) * CELLS;
+            }
+
+            const BlockCols* blocks = rows.find(by);
+            if (blocks == nullptr)
+                return nullptr;
+            const Tile* tile = blocks->find(bx);
+            return tile == nullptr ? nullptr : tile->cells;
+        }
+
+        // out[r] = sum over the tiles of tile row r . x, for the n tiles of a block row
+        template <typename U>
+        static void blockRowProduct(const size_t* cols, const U* tiles, size_t n, const U* x, U* out) {
+            U sums[B];
+            for (size_t r = 0; r < B; r++)
+                sums[r] = U();
+            for (size_t t = 0; t < n; t++) {
+                const U* tile = tiles + t * CELLS;
+                const U* xs = x + cols[t] * B;
+                for (size_t r = 0; r < B; r++) {
+                    U sum = U();
+                    for (size_t c = 0; c < B; c++)
+                        sum += tile[r * B + c] * xs[c];
+                    sums[r] += sum;
+                }
+            }
+            std::copy(sums, sums + B, out);
+        }
+
+#ifdef BLOCKSPARSEMATRIX_AVX2
+        // tile rows are whole registers: each keeps its own sums over the block row,
+        // which are added across only once at the end
+        static void blockRowProduct(const size_t* cols, const double* tiles, size_t n, const double* x, double* out) {
+            if constexpr (B % 4 != 0)
+                blockRowProduct<double>(cols, tiles, n, x, out);
+            else {
+                __m256d sums[B];
+                for (size_t r = 0; r < B; r++)
+                    sums[r] = _mm256_setzero_pd();
+                for (size_t t = 0; t < n; t++) {
+                    const double* tile = tiles + t * CELLS;
+                    const double* xs = x + cols[t] * B;
+                    for (size_t c = 0; c < B; c += 4) {
+                        __m256d xv = _mm256_loadu_pd(xs + c);
+                        for (size_t r = 0; r < B; r++)
+                            sums[r] = _mm256_add_pd(sums[r], _mm256_mul_pd(_mm256_loadu_pd(tile + r * B + c), xv));
+                    }
+                }
+                for (size_t r = 0; r < B; r++) {
+                    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(sums[r]), _mm256_extractf128_pd(sums[r], 1));
+                    out[r] = _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+                }
+            }
+        }
+
+        static void blockRowProduct(const size_t* cols, const float* tiles, size_t n, const float* x, float* out) {
+            if constexpr (B % 8 != 0)
+                blockRowProduct<float>(cols, tiles, n, x, out);
+            else {
+                __m256 sums[B];
+                for (size_t r = 0; r < B; r++)
+                    sums[r] = _mm256_setzero_ps();
+                for (size_t t = 0; t < n; t++) {
+                    const float* tile = tiles + t * CELLS;
+                    const float* xs = x + cols[t] * B;
+                    for (size_t c = 0; c < B; c += 8) {
+                        __m256 xv = _mm256_loadu_ps(xs + c);
+                        for (size_t r = 0; r < B; r++)
+                            sums[r] = _mm256_add_ps(sums[r], _mm256_mul_ps(_mm256_loadu_ps(tile + r * B + c), xv));
+                    }
+                }
+                for (size_t r = 0; r < B; r++) {
+                    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sums[r]), _mm256_extractf128_ps(sums[r], 1));
+                    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+                    out[r] = _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+                }
+            }
+        }
+#endif
+
+    public:
+        class Cell {
+            protected:
+                BlockSparseMatrix& matrix;
+                size_t x, y;
+
+            public:
+                Cell(BlockSparseMatrix& matrix, size_t x, size_t y) : matrix(matrix), x(x), y(y) {};
+
+                const T& operator=(const T& data) {
+                    matrix.checkMutable();
+                    const size_t by = y / B,
+                                 bx = x / B,
+                                 i = cellOf(y, x);
+                    BlockCols* blocks = matrix.rows.find(by);
+                    Tile* tile = blocks == nullptr ? nullptr : blocks->find(bx);
+
+                    if (data == matrix.defaultValue) {
+                        if (tile == nullptr || tile->cells[i] == matrix.defaultValue)
+                            return matrix.defaultValue;
+
+                        tile->cells[i] = data;
+                        if (--tile->filled == 0) {
+                            blocks->remove(bx);
+                            if (blocks->empty())
+                                matrix.rows.remove(by);
+                        }
+                        return matrix.defaultValue;
+                    }
+
+                    if (tile == nullptr) {
+                        if (blocks == nullptr)
+                            blocks = &matrix.rows[by];
+                        blocks->insert(bx, Tile(matrix.defaultValue));
+                        tile = blocks->find(bx);
+                    }
+                    if (tile->cells[i] == matrix.defaultValue)
+                        tile->filled++;
+                    tile->cells[i] = data;
+                    return tile->cells[i];
+                }
+
+                const T& operator*() const {
+                    return matrix.at(y, x);
+                }
+
+                friend std::ostream& operator<<(std::ostream& os, const Cell& c) {
+                    os << *c;
+                    return os;
+                }
+        };
+
+        class Row {
+            protected:
+                BlockSparseMatrix& matrix;
+                size_t y;
+
+            public:
+                Row(BlockSparseMatrix& matrix, size_t y) : matrix(matrix), y(y) {};
+
+                Cell operator[](size_t x) {
+                    if (x >= matrix._width)
+                        throw std::invalid_argument("invalid matrix coordinates");
+                    return Cell(matrix, x, y);
+                };
+        };
+
+        BlockSparseMatrix(const T& defaultValue, size_t w, size_t h)
+            : defaultValue(defaultValue), _width(w), _height(h), _layout(TREES) {};
+
+        // stores share their values when copied, so the copy rebuilds its own tiles
+        BlockSparseMatrix(const BlockSparseMatrix& other)
+            : defaultValue(other.defaultValue), _width(other._width), _height(other._height), _layout(other._layout),
+              offsets(other.offsets), indices(other.indices), values(other.values) {
+            std::vector<std::pair<size_t, BlockCols>> built;
+            std::vector<std::pair<size_t, Tile>> tiles;
+            for (auto r = other.rows.cbegin(), rEnd = other.rows.cend(); r != rEnd; ++r) {
+                tiles.clear();
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                    tiles.emplace_back(c->first, *c->second);
+                built.emplace_back(r->first, BlockCols::fromSorted(tiles.cbegin(), tiles.size()));
+            }
+            rows = BlockRows::fromSorted(std::make_move_iterator(built.begin()), built.size());
+        }
+
+        BlockSparseMatrix(BlockSparseMatrix&& other) = default;
+
+        BlockSparseMatrix& operator=(BlockSparseMatrix other) {
+            std::swap(defaultValue, other.defaultValue);
+            std::swap(_width, other._width);
+            std::swap(_height, other._height);
+            std::swap(rows, other.rows);
+            std::swap(_layout, other._layout);
+            std::swap(offsets, other.offsets);
+            std::swap(indices, other.indices);
+            std::swap(values, other.values);
+            return *this;
+        }
+
+        /* Builds a matrix out of (row, col, value) triplets in any order, as
+           SparseMatrix::fromTriplets does: the triplets are sorted by tile in parallel,
+           those on the same cell are folded with combine(value, next) in their input
+           order, and tiles left with only default values are dropped */
+        template <typename InputIt, typename Combine>
+        static BlockSparseMatrix fromTriplets(const T& defaultValue, size_t w, size_t h,
+                                              InputIt first, InputIt last, Combine combine,
+                                              Layout layout = TREES, unsigned int threads = 0) {
+            std::vector<Triplet> cells(first, last);
+            for (const Triplet& t : cells) {
+                if (t.row >= h || t.col >= w)
+                    throw std::invalid_argument("invalid matrix coordinates");
+            }
+
+            // by tile only, the sort being stable keeps the cells of a tile in input order
+            SparseMatrix<T>::parallelSort(cells.begin(), cells.end(), [](const Triplet& a, const Triplet& b) {
+                return a.row / B < b.row / B || (a.row / B == b.row / B && a.col / B < b.col / B);
+            }, threads);
+
+            std::vector<size_t> tileRows;
+            std::vector<std::pair<size_t, Tile>> tiles;
+            bool set[CELLS];
+            for (size_t i = 0; i < cells.size(); ) {
+                const size_t by = cells[i].row / B,
+                             bx = cells[i].col / B;
+                Tile tile(defaultValue);
+                std::fill(set, set + CELLS, false);
+                for (; i < cells.size() && cells[i].row / B == by && cells[i].col / B == bx; i++) {
+                    const size_t c = cellOf(cells[i].row, cells[i].col);
+                    tile.cells[c] = set[c] ? combine(tile.cells[c], cells[i].value) : cells[i].value;
+                    set[c] = true;
+                }
+
+                for (size_t c = 0; c < CELLS; c++) {
+                    if (!(tile.cells[c] == defaultValue))
+                        tile.filled++;
+                }
+                if (tile.filled > 0) {
+                    tileRows.push_back(by);
+                    tiles.emplace_back(bx, tile);
+                }
+            }
+
+            BlockSparseMatrix m(defaultValue, w, h);
+            if (layout == BSR) {
+                m.offsets.assign(blocksOf(h) + 1, 0);
+                m.indices.resize(tiles.size());
+                m.values.resize(tiles.size() * CELLS);
+                for (size_t t = 0; t < tiles.size(); t++) {
+                    m.offsets[tileRows[t] + 1]++;
+                    m.indices[t] = tiles[t].first;
+                    std::copy(tiles[t].second.cells, tiles[t].second.cells + CELLS, m.values.begin() + t * CELLS);
+                }
+                for (size_t i = 0; i + 1 < m.offsets.size(); i++)
+                    m.offsets[i + 1] += m.offsets[i];
+                m._layout = BSR;
+                return m;
+            }
+
+            // the first tile of every block row
+            std::vector<size_t> starts;
+            for (size_t t = 0; t < tiles.size(); t++) {
+                if (t == 0 || tileRows[t] != tileRows[t - 1])
+                    starts.push_back(t);
+            }
+            starts.push_back(tiles.size());
+
+            std::vector<std::pair<size_t, BlockCols>> built(starts.size() - 1);
+            SparseMatrix<T>::runParts(SparseMatrix<T>::partition(starts, threads),
+                                      [&tiles, &tileRows, &starts, &built](size_t, size_t from, size_t to) {
+                for (size_t r = from; r < to; r++) {
+                    built[r].first = tileRows[starts[r]];
+                    built[r].second = BlockCols::fromSorted(std::make_move_iterator(tiles.begin() + starts[r]),
+                                                            starts[r + 1] - starts[r]);
+                }
+            });
+            m.rows = BlockRows::fromSorted(std::make_move_iterator(built.begin()), built.size());
+            return m;
+        }
+
+        // packs the tiles into block compressed rows
+        void freeze() {
+            if (_layout == BSR)
+                return;
+
+            std::vector<size_t> o(blocksOf(_height) + 1, 0);
+            std::vector<size_t> ind;
+            std::vector<T> val;
+            for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c) {
+                    ind.push_back(c->first);
+                    val.insert(val.end(), c->second->cells, c->second->cells + CELLS);
+                    o[r->first + 1]++;
+                }
+            }
+            for (size_t i = 0; i + 1 < o.size(); i++)
+                o[i + 1] += o[i];
+
+            offsets.swap(o);
+            indices.swap(ind);
+            values.swap(val);
+            rows = BlockRows();
+            _layout = BSR;
+        }
+
+        // puts a frozen matrix back into trees
+        void thaw() {
+            if (_layout == TREES)
+                return;
+
+            BlockRows r;
+            for (size_t by = 0; by + 1 < offsets.size(); by++) {
+                for (size_t t = offsets[by]; t < offsets[by + 1]; t++) {
+                    Tile tile;
+                    std::copy(values.begin() + t * CELLS, values.begin() + (t + 1) * CELLS, tile.cells);
+                    for (size_t c = 0; c < CELLS; c++) {
+                        if (!(tile.cells[c] == defaultValue))
+                            tile.filled++;
+                    }
+                    r[by].insert(indices[t], tile);
+                }
+            }
+
+            rows = std::move(r);
+            offsets = std::vector<size_t>();
+            indices = std::vector<size_t>();
+            values = std::vector<T>();
+            _layout = TREES;
+        }
+
+        Layout layout() const {
+            return _layout;
+        }
+
+        // calls f(block row, block col, cells) for every tile, in ascending block rows
+        // and then block cols, its B * B cells row by row
+        template <typename F>
+        void forEachTile(F f) const {
+            if (_layout != TREES) {
+                for (size_t by = 0; by + 1 < offsets.size(); by++) {
+                    for (size_t t = offsets[by]; t < offsets[by + 1]; t++)
+                        f(by, indices[t], values.data() + t * CELLS);
+                }
+                return;
+            }
+
+            for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                    f(r->first, c->first, static_cast<const T*>(c->second->cells));
+            }
+        }
+
+        // y = A x. block rows are spread over threads by their tiles (threads = 0 takes one
+        // per core), and each is read once, its B outputs kept in registers throughout
+        void multiply(const std::vector<T>& x, std::vector<T>& y, unsigned int threads = 0) const {
+            if (_layout != BSR)
+                throw std::logic_error("products need a frozen matrix");
+            if (!(defaultValue == T()))
+                throw std::logic_error("products need a zero default value");
+            if (x.size() != _width)
+                throw std::invalid_argument("vector size does not match the matrix");
+            if (&x == &y)
+                throw std::invalid_argument("product would overwrite its operand");
+
+            // edge tiles read up to the next multiple of B
+            std::vector<T> padded;
+            const T* xs = x.data();
+            if (_width % B != 0) {
+                padded.assign(blocksOf(_width) * B, T());
+                std::copy(x.begin(), x.end(), padded.begin());
+                xs = padded.data();
+            }
+
+            y.assign(_height, T());
+            const size_t height = _height;
+            const size_t* o = offsets.data();
+            const size_t* ind = indices.data();
+            const T* val = values.data();
+            T* out = y.data();
+            SparseMatrix<T>::runParts(SparseMatrix<T>::partition(offsets, threads),
+                                      [o, ind, val, xs, out, height](size_t, size_t first, size_t last) {
+                T sums[B];
+                for (size_t by = first; by < last; by++) {
+                    blockRowProduct(ind + o[by], val + o[by] * CELLS, o[by + 1] - o[by], xs, sums);
+                    std::copy(sums, sums + std::min(B, height - by * B), out + by * B);
+                }
+            });
+        }
+
+        // tiles kept, and the cells in them differing from the default value
+        size_t tiles() const {
+            if (_layout != TREES)
+                return indices.size();
+
+            size_t n = 0;
+            forEachTile([&n](size_t, size_t, const T*) {
+                n++;
+            });
+            return n;
+        }
+
+        size_t nonZeros() const {
+            size_t n = 0;
+            forEachTile([this, &n](size_t, size_t, const T* cells) {
+                for (size_t c = 0; c < CELLS; c++) {
+                    if (!(cells[c] == defaultValue))
+                        n++;
+                }
+            });
+            return n;
+        }
+
+        Row operator[](size_t y) {
+            if (y >= _height)
+                throw std::invalid_argument("invalid matrix coordinates");
+            return Row(*this, y);
+        };
+
+        const T& at(size_t y, size_t x) const {
+            const T* tile = tileOf(y / B, x / B);
+            return tile == nullptr ? defaultValue : tile[cellOf(y, x)];
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const BlockSparseMatrix& m) {
+            os << "---------------------" << std::endl;
+            for (size_t y = 0; y < m._height; y++) {
+                for (size_t x = 0; x < m._width; x++)
+                    os << m.at(y, x) << " ";
+                os << std::endl;
+            }
+            os << "---------------------";
+            return os;
+        };
+
+        size_t width() const {
+            return _width;
+        };
+
+        size_t height() const {
+            return _height;
+        };
+};
+
+#endif
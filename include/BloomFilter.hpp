@@ -0,0 +1,175 @@
+#ifndef BLOOMFILTER_INCLUDED
+#define BLOOMFILTER_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define BLOOMFILTER_AVX2
+#include <immintrin.h>
+#endif
+
+/* Filters answer whether a set may contain a 64 bit hash, with no false negatives.
+   they share an interface, so that stores can take either of them
+
+       static constexpr uint16_t KIND   tells the filters apart in files
+       Filter(const std::vector<uint64_t>& hashes, double falsePositiveRate)
+       bool mayContain(uint64_t hash) const
+       size_t bytes() const
+       void encode(std::vector<char>& out) const
+       static const char* decode(const char* in, const char* end, Filter& out)
+
+   like codecs, decode returns a pointer past the encoding it read, and throws on
+   truncated input */
+
+// spreads the bits of hashes which are poor on their own, such as std::hash of integers
+inline uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Blocked Bloom filter. the upper half of a hash picks a cache line sized block,
+   and the lower half sets one bit in each of its 8 words, so that a probe touches a
+   single cache line and its 8 bits can be tested at once
+
+   FORMAT
+   (uint64_t) blocks
+   (Block)[]  blocks */
+class BloomFilter {
+    public:
+        static constexpr uint16_t KIND = 1;
+        static constexpr size_t LANES = 8;
+
+        BloomFilter() {}
+
+        // sized for the false positive rate, at the least bits per key reaching it
+        BloomFilter(const std::vector<uint64_t>& hashes, double falsePositiveRate = 0.01)
+            : blocks(blockCount(hashes.size(), bitsPerKey(falsePositiveRate))) {
+            for (uint64_t hash : hashes)
+                insert(hash);
+        }
+
+        BloomFilter(size_t keys, double bitsPerKey)
+            : blocks(blockCount(keys, bitsPerKey)) {}
+
+        void insert(uint64_t hash) {
+            Block& block = blocks[blockOf(hash)];
+            uint64_t masks[LANES];
+            maskOf(hash, masks);
+            for (size_t i = 0; i < LANES; i++)
+                block.lanes[i] |= masks[i];
+        }
+
+        bool mayContain(uint64_t hash) const {
+            if (blocks.empty())
+                return true;
+
+            const Block& block = blocks[blockOf(hash)];
+#ifdef BLOOMFILTER_AVX2
+            const __m256i salts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(SALTS));
+            __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<uint32_t>(hash)), salts), 26);
+            const __m256i one = _mm256_set1_epi64x(1);
+            __m256i low = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bits)));
+            __m256i high = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bits, 1)));
+
+            // testc is set when every bit of the mask is set in the block
+            return _mm256_testc_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(block.lanes)), low) &
+                   _mm256_testc_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(block.lanes + 4)), high);
+#else
+            uint64_t masks[LANES];
+            maskOf(hash, masks);
+            uint64_t missing = 0;
+            for (size_t i = 0; i < LANES; i++)
+                missing |= masks[i] & ~block.lanes[i];
+            return missing == 0;
+#endif
+        }
+
+        size_t bytes() const {
+            return blocks.size() * sizeof(Block);
+        }
+
+        // expected false positive rate at bitsPerKey, over the Poisson distribution
+        // of keys per block
+        static double falsePositiveRate(double bitsPerKey) {
+            const double keysPerBlock = sizeof(Block) * 8 / bitsPerKey;
+            double p = std::exp(-keysPerBlock), rate = 0;
+            for (size_t keys = 0; keys < 20 * keysPerBlock + 100; keys++) {
+                double bitSet = 1 - std::pow(1 - 1.0 / 64, static_cast<double>(keys));
+                rate += p * std::pow(bitSet, static_cast<double>(LANES));
+                p *= keysPerBlock / (keys + 1);
+            }
+            return rate;
+        }
+
+        // least bits per key (in eighths) reaching falsePositiveRate
+        static double bitsPerKey(double rate) {
+            if (!(rate > 0 && rate < 1))
+                throw std::invalid_argument("false positive rate must lie in (0, 1)");
+
+            double bits = 1;
+            while (bits < 64 && falsePositiveRate(bits) > rate)
+                bits += 0.125;
+            return bits;
+        }
+
+        void encode(std::vector<char>& out) const {
+            uint64_t count = blocks.size();
+            const char* raw = reinterpret_cast<const char*>(&count);
+            out.insert(out.end(), raw, raw + sizeof(uint64_t));
+            raw = reinterpret_cast<const char*>(blocks.data());
+            out.insert(out.end(), raw, raw + bytes());
+        }
+
+        static const char* decode(const char* in, const char* end, BloomFilter& out) {
+            uint64_t count;
+            if (end - in < static_cast<ptrdiff_t>(sizeof(uint64_t)))
+                throw std::runtime_error("truncated Bloom filter");
+            std::memcpy(&count, in, sizeof(uint64_t));
+            in += sizeof(uint64_t);
+            if (static_cast<uint64_t>(end - in) / sizeof(Block) < count)
+                throw std::runtime_error("truncated Bloom filter");
+
+            out.blocks.resize(count);
+            std::memcpy(out.blocks.data(), in, out.bytes());
+            return in + out.bytes();
+        }
+
+    private:
+        struct alignas(64) Block {
+            uint64_t lanes[LANES];
+        };
+
+        // odd multipliers spreading the lower half of a hash over the lanes
+        static constexpr uint32_t SALTS[LANES] = {
+            0x47B6137BU, 0x44974D91U, 0x8824AD5BU, 0xA2B7289DU,
+            0x705495C7U, 0x2DF1424BU, 0x9EFC4947U, 0x5C6BFB31U
+        };
+
+        std::vector<Block> blocks;
+
+        static size_t blockCount(size_t keys, double bitsPerKey) {
+            return std::max<size_t>(static_cast<size_t>(std::ceil(keys * bitsPerKey / (sizeof(Block) * 8))), 1);
+        }
+
+        size_t blockOf(uint64_t hash) const {
+            return static_cast<size_t>(((hash >> 32) * blocks.size()) >> 32);
+        }
+
+        static void maskOf(uint64_t hash, uint64_t* masks) {
+            uint32_t low = static_cast<uint32_t>(hash);
+            for (size_t i = 0; i < LANES; i++)
+                masks[i] = uint64_t(1) << ((low * SALTS[i]) >> 26);
+        }
+};
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef BUFFERPOOL_INCLUDED
+#define BUFFERPOOL_INCLUDED
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <algorithm>
+#include <utility>
+#include <iostream>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/* Page cache shared by the storages of a process, holding at most capacity bytes
+   of pages. pages are split among PARTITIONS partitions by a hash of their file and
+   number, each with its own latch and CLOCK hand, so that threads working on
+   different pages seldom wait on each other
+
+   a page is pinned while in use and cannot be evicted until its last pin goes.
+   pages changed while pinned are written back when evicted or flushed, through
+   the Client they belong to */
+class BufferPool {
+    public:
+        static constexpr size_t PARTITIONS = 16;
+        static constexpr size_t DEFAULT_CAPACITY = 64 << 20;
+
+        // a file whose pages go through the pool. both calls come with the latch of
+        // the partition of the page held, so they must not take locks of their own
+        class Client {
+            public:
+                virtual ~Client() {}
+
+                virtual size_t pageBytes() const = 0;
+
+                // reads a page from the file, throwing if it is corrupt
+                virtual void load(size_t page, char* data) const = 0;
+
+                // writes a changed page back to the file
+                virtual void store(size_t page, char* data) = 0;
+        };
+
+        struct Stats {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            uint64_t writeBacks;
+            size_t frames;
+            size_t bytes;
+
+            friend std::ostream& operator<<(std::ostream& os, const Stats& s) {
+                uint64_t lookups = s.hits + s.misses;
+                os << s.frames << " frames, " << s.bytes << " bytes, " << s.hits << " hits, " << s.misses << " misses";
+                if (lookups > 0)
+                    os << " (" << 100.0 * s.hits / lookups << "% hits)";
+                os << ", " << s.evictions << " evictions, " << s.writeBacks << " write backs";
+                return os;
+            }
+        };
+
+    private:
+        struct Frame {
+            Client* client;
+            size_t page;
+            std::vector<char> data;
+            unsigned int pins;
+            bool dirty;
+            bool referenced; // touched since the hand last went by
+            bool used;
+        };
+
+        struct Key {
+            const Client* client;
+            size_t page;
+
+            bool operator==(const Key& other) const {
+                return client == other.client && page == other.page;
+            }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                uint64_t h = reinterpret_cast<uintptr_t>(key.client) * 0x9E3779B97F4A7C15ULL ^ key.page * 0xC2B2AE3D27D4EB4FULL;
+                return static_cast<size_t>(h ^ (h >> 29));
+            }
+        };
+
+        struct Partition {
+            Partition() : hand(0), bytes(0), stores(0), hits(0), misses(0), evictions(0), writeBacks(0) {}
+
+            std::mutex latch;
+            std::vector<Frame> frames;
+            std::vector<size_t> unused;
+            std::unordered_map<Key, size_t, KeyHash> index;
+            std::unordered_set<size_t> dirty;
+            size_t hand;
+            size_t bytes;
+            uint64_t stores; // dirty pages written so far, see stamp()
+            uint64_t hits, misses, evictions, writeBacks;
+        };
+
+    public:
+        // a pin on a page, released when destroyed
+        class Page {
+            public:
+                Page() : partition(nullptr), frame(0), bytes(nullptr), page(0) {}
+
+                // a page held outside the pool, such as in a mapping
+                Page(char* data, size_t page) : partition(nullptr), frame(0), bytes(data), page(page) {}
+
+                virtual ~Page() {
+                    release();
+                }
+
+                Page(const Page& other) = delete;
+                Page& operator=(const Page& other) = delete;
+
+                Page(Page&& other) : partition(other.partition), frame(other.frame), bytes(other.bytes), page(other.page) {
+                    other.partition = nullptr;
+                    other.bytes = nullptr;
+                }
+
+                Page& operator=(Page&& other) {
+                    if (this != &other) {
+                        release();
+                        partition = other.partition;
+                        frame = other.frame;
+                        bytes = other.bytes;
+                        page = other.page;
+                        other.partition = nullptr;
+                        other.bytes = nullptr;
+                    }
+                    return *this;
+                }
+
+                char* data() const {
+                    return bytes;
+                }
+
+                size_t number() const {
+                    return page;
+                }
+
+                explicit operator bool() const {
+                    return bytes != nullptr;
+                }
+
+                void release() {
+                    if (partition != nullptr) {
+                        std::lock_guard<std::mutex> latch(partition->latch);
+                        Frame& f = partition->frames[frame];
+                        if (--f.pins == 0 && !f.used) // discarded while pinned
+                            partition->unused.push_back(frame);
+                    }
+                    partition = nullptr;
+                    bytes = nullptr;
+                }
+
+            private:
+                friend class BufferPool;
+
+                Page(Partition* partition, size_t frame, char* data, size_t page)
+                    : partition(partition), frame(frame), bytes(data), page(page) {}
+
+                Partition* partition;
+                size_t frame;
+                char* bytes;
+                size_t page;
+        };
+
+        // process wide instance, so that every storage shares the same budget
+        static BufferPool& shared() {
+            static BufferPool instance;
+            return instance;
+        }
+
+        explicit BufferPool(size_t capacity = DEFAULT_CAPACITY) : partitionCapacity(capacity / PARTITIONS) {}
+
+        BufferPool(const BufferPool& other) = delete;
+        BufferPool& operator=(const BufferPool& other) = delete;
+
+        size_t capacity() const {
+            return partitionCapacity * PARTITIONS;
+        }
+
+        // pins a page, reading it on a miss. pages pinned to be written are marked dirty
+        Page pin(Client& client, size_t page, bool write = false) {
+            Partition& p = partitionOf(client, page);
+            std::lock_guard<std::mutex> latch(p.latch);
+            auto found = p.index.find(Key{&client, page});
+            size_t f;
+            if (found != p.index.end()) {
+                f = found->second;
+                p.hits++;
+            }
+            else {
+                f = load(p, client, page, nullptr);
+                p.misses++;
+            }
+            return take(p, f, write);
+        }
+
+        // pins a page only if it is in the pool
+        Page pinResident(Client& client, size_t page) {
+            Partition& p = partitionOf(client, page);
+            std::lock_guard<std::mutex> latch(p.latch);
+            auto found = p.index.find(Key{&client, page});
+            if (found == p.index.end())
+                return Page();
+            p.hits++;
+            return take(p, found->second, false);
+        }
+
+        // a value which changes whenever a changed page of the partition of page is
+        // written back, to tell whether a copy read from the file since is still current
+        uint64_t stamp(const Client& client, size_t page) {
+            Partition& p = partitionOf(client, page);
+            std::lock_guard<std::mutex> latch(p.latch);
+            return p.stores;
+        }
+
+        // pins a page read from the file by the caller, which is taken as is if
+        // nothing was written back since stamp, and read again otherwise or if data is null
+        Page install(Client& client, size_t page, const char* data, uint64_t stamp) {
+            Partition& p = partitionOf(client, page);
+            std::lock_guard<std::mutex> latch(p.latch);
+            auto found = p.index.find(Key{&client, page});
+            size_t f;
+            if (found != p.index.end()) {
+                f = found->second;
+                p.hits++;
+            }
+            else {
+                f = load(p, client, page, data != nullptr && p.stores == stamp ? data : nullptr);
+                p.misses++;
+            }
+            return take(p, f, false);
+        }
+
+        // copies of the changed pages of client in [first, first + count)
+        std::map<size_t, std::vector<char>> dirtyCopies(const Client& client, size_t first, size_t count) {
+            std::map<size_t, std::vector<char>> copies;
+            for (size_t page = first; page < first + count; page++) {
+                Partition& p = partitionOf(client, page);
+                std::lock_guard<std::mutex> latch(p.latch);
+                auto found = p.index.find(Key{&client, page});
+                if (found != p.index.end() && p.frames[found->second].dirty)
+                    copies.emplace(page, p.frames[found->second].data);
+            }
+            return copies;
+        }
+
+        // copies a page from the pool if it is there, returning true, and reads it otherwise
+        bool read(const Client& client, size_t page, char* out) {
+            Partition& p = partitionOf(client, page);
+            std::lock_guard<std::mutex> latch(p.latch);
+            auto found = p.index.find(Key{&client, page});
+            if (found == p.index.end()) {
+                client.load(page, out);
+                return false;
+            }
+            std::copy(p.frames[found->second].data.begin(), p.frames[found->second].data.end(), out);
+            return true;
+        }
+
+        // the changed pages of client, sorted. they stay dirty until clean() is called
+        // once they are written, so that they are written back if evicted before that
+        std::vector<size_t> dirtyPages(const Client& client) {
+            std::vector<size_t> pages;
+            for (Partition& p : partitions) {
+                std::lock_guard<std::mutex> latch(p.latch);
+                for (size_t f : p.dirty) {
+                    if (p.frames[f].client == &client)
+                        pages.push_back(p.frames[f].page);
+                }
+            }
+            std::sort(pages.begin(), pages.end());
+            return pages;
+        }
+
+        void clean(const Client& client, size_t page) {
+            Partition& p = partitionOf(client, page);
+            std::lock_guard<std::mutex> latch(p.latch);
+            auto found = p.index.find(Key{&client, page});
+            if (found != p.index.end() && p.frames[found->second].dirty) {
+                p.frames[found->second].dirty = false;
+                p.dirty.erase(found->second);
+                p.stores++;
+            }
+        }
+
+        // drops the pages of client from page from on, without writing them back.
+        // pages still pinned are only freed once their last pin goes
+        void discard(const Client& client, size_t from = 0) {
+            for (Partition& p : partitions) {
+                std::lock_guard<std::mutex> latch(p.latch);
+                for (size_t f = 0; f < p.frames.size(); f++) {
+                    Frame& frame = p.frames[f];
+                    if (!frame.used || frame.client != &client || frame.page < from)
+                        continue;
+
+                    drop(p, f);
+                    if (frame.pins == 0) {
+                        p.bytes -= frame.data.size();
+                        std::vector<char>().swap(frame.data);
+                        p.unused.push_back(f);
+                    }
+                }
+            }
+        }
+
+        Stats stats() {
+            Stats s = {0, 0, 0, 0, 0, 0};
+            for (Partition& p : partitions) {
+                std::lock_guard<std::mutex> latch(p.latch);
+                s.hits += p.hits;
+                s.misses += p.misses;
+                s.evictions += p.evictions;
+                s.writeBacks += p.writeBacks;
+                s.frames += p.index.size();
+                s.bytes += p.bytes;
+            }
+            return s;
+        }
+
+    private:
+        size_t partitionCapacity;
+        Partition partitions[PARTITIONS];
+
+        Partition& partitionOf(const Client& client, size_t page) {
+            return partitions[KeyHash()(Key{&client, page}) % PARTITIONS];
+        }
+
+        Page take(Partition& p, size_t f, bool write) {
+            Frame& frame = p.frames[f];
+            frame.pins++;
+            frame.referenced = true;
+            if (write && !frame.dirty) {
+                frame.dirty = true;
+                p.dirty.insert(f);
+            }
+            return Page(&p, f, frame.data.data(), frame.page);
+        }
+
+        // brings a page into a free frame, copying it from data or reading it
+        size_t load(Partition& p, Client& client, size_t page, const char* data) {
+            size_t f = frameFor(p, client.pageBytes());
+            Frame& frame = p.frames[f];
+            try {
+                if (data != nullptr)
+                    std::copy(data, data + frame.data.size(), frame.data.begin());
+                else
+                    client.load(page, frame.data.data());
+            } catch (...) {
+                frame.used = false;
+                p.unused.push_back(f);
+                throw;
+            }
+
+            frame.client = &client;
+            frame.page = page;
+            frame.pins = 0;
+            frame.dirty = false;
+            frame.referenced = true;
+            frame.used = true;
+            p.index.emplace(Key{&client, page}, f);
+            return f;
+        }
+
+        // a frame of bytes bytes, new while the partition is under budget and
+        // taken from the first page the clock hand finds unpinned and unreferenced otherwise
+        size_t frameFor(Partition& p, size_t bytes) {
+            size_t f;
+            if (!p.unused.empty()) {
+                f = p.unused.back();
+                p.unused.pop_back();
+            }
+            else if (p.bytes + bytes <= partitionCapacity || p.frames.empty()) {
+                f = p.frames.size();
+                p.frames.push_back(Frame{nullptr, 0, std::vector<char>(), 0, false, false, false});
+            }
+            else
+                f = evict(p);
+
+            Frame& frame = p.frames[f];
+            p.bytes += bytes - frame.data.size();
+            frame.data.resize(bytes);
+            return f;
+        }
+
+        size_t evict(Partition& p) {
+            for (size_t steps = 0; steps < 2 * p.frames.size(); steps++) {
+                size_t f = p.hand;
+                p.hand = (p.hand + 1) % p.frames.size();
+
+                Frame& frame = p.frames[f];
+                if (frame.pins > 0)
+                    continue;
+                if (frame.referenced) {
+                    frame.referenced = false;
+                    continue;
+                }
+
+                if (frame.dirty) {
+                    frame.client->store(frame.page, frame.data.data());
+                    p.writeBacks++;
+                    p.stores++;
+                }
+                p.evictions++;
+                drop(p, f);
+                return f;
+            }
+            throw std::runtime_error("every page of a buffer pool partition is pinned");
+        }
+
+        // takes a page out of the index. the frame is free once unpinned
+        void drop(Partition& p, size_t f) {
+            Frame& frame = p.frames[f];
+            p.index.erase(Key{frame.client, frame.page});
+            p.dirty.erase(f);
+            frame.used = false;
+            frame.dirty = false;
+            frame.referenced = false;
+        }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef CHECKSUM_INCLUDED
+#define CHECKSUM_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHECKSUM_SSE42
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CHECKSUM_ARM_CRC32
+#include <arm_acle.h>
+#endif
+
+// CRC32C (Castagnoli), using the crc32 instructions of SSE4.2 or ARMv8 when
+// the processor has them and a slicing-by-8 table otherwise
+class CRC32C {
+    public:
+        // extends crc with n more bytes, so that checksums can be computed in pieces
+        static uint32_t compute(const char* data, size_t n, uint32_t crc = 0) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+            crc = ~crc;
+#if defined(CHECKSUM_SSE42)
+            crc = hardware() ? extendSSE42(crc, p, n) : extendSoftware(crc, p, n);
+#elif defined(CHECKSUM_ARM_CRC32)
+            crc = extendARM(crc, p, n);
+#else
+            crc = extendSoftware(crc, p, n);
+#endif
+            return ~crc;
+        }
+
+        static bool hardware() {
+#if defined(CHECKSUM_SSE42)
+            static const bool supported = __builtin_cpu_supports("sse4.2");
+            return supported;
+#elif defined(CHECKSUM_ARM_CRC32)
+            return true;
+#else
+            return false;
+#endif
+        }
+
+    private:
+        static constexpr uint32_t POLYNOMIAL = 0x82F63B78; // reversed
+
+        struct Tables {
+            uint32_t t[8][256];
+
+            Tables() {
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t crc = i;
+                    for (int bit = 0; bit < 8; bit++)
+                        crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+                    t[0][i] = crc;
+                }
+                for (int k = 1; k < 8; k++) {
+                    for (uint32_t i = 0; i < 256; i++)
+                        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+        };
+
+        static const Tables& tables() {
+            static const Tables instance;
+            return instance;
+        }
+
+        static uint32_t extendSoftware(uint32_t crc, const unsigned char* p, size_t n) {
+            const Tables& tb = tables();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            while (n >= 8) { // eight bytes per step, which needs a little endian load
+                uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                word ^= crc;
+                crc = tb.t[7][word & 0xFF] ^ tb.t[6][(word >> 8) & 0xFF] ^
+                      tb.t[5][(word >> 16) & 0xFF] ^ tb.t[4][(word >> 24) & 0xFF] ^
+                      tb.t[3][(word >> 32) & 0xFF] ^ tb.t[2][(word >> 40) & 0xFF] ^
+                      tb.t[1][(word >> 48) & 0xFF] ^ tb.t[0][word >> 56];
+                p += 8;
+                n -= 8;
+            }
+#endif
+            while (n-- > 0)
+                crc = (crc >> 8) ^ tb.t[0][(crc ^ *p++) & 0xFF];
+            return crc;
+        }
+
+#if defined(CHECKSUM_SSE42)
+        __attribute__((target("sse4.2")))
+        static uint32_t extendSSE42(uint32_t crc, const unsigned char* p, size_t n) {
+            uint64_t crc64 = crc;
+            while (n >= 8) {
+                uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                crc64 = _mm_crc32_u64(crc64, word);
+                p += 8;
+                n -= 8;
+            }
+            crc = static_cast<uint32_t>(crc64);
+            while (n-- > 0)
+                crc = _mm_crc32_u8(crc, *p++);
+            return crc;
+        }
+#endif
+
+#if defined(CHECKSUM_ARM_CRC32)
+        static uint32_t extendARM(uint32_t crc, const unsigned char* p, size_t n) {
+            while (n >= 8) {
+                uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                crc = __crc32cd(crc, word);
+                p += 8;
+                n -= 8;
+            }
+            while (n-- > 0)
+                crc = __crc32cb(crc, *p++);
+            return crc;
+        }
+#endif
+};
+
+#endif
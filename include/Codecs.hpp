@@ -0,0 +1,397 @@
+#ifndef CODECS_INCLUDED
+#define CODECS_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#define CODECS_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Lightweight codecs for blocks of records. Like serializers, they are classes
+   with static members only
+
+   integer codecs work on columns of n values of width bytes (4 or 8), widened
+   to uint64_t, and append their encoding to a byte vector. decode returns a
+   pointer past the encoding it read, and throws on truncated input */
+
+// little endian base 128 integers
+struct VarInt {
+    static void put(std::vector<char>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static uint64_t get(const char*& in, const char* end) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (in == end)
+                throw std::runtime_error("truncated varint");
+            uint8_t byte = *in++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("varint too long");
+    }
+};
+
+/* Packs n values of bits bits each
+   bits <= 32: four interleaved lanes of 32 bit words, value i going to lane i % 4,
+               so that four values are unpacked at once with the same shifts
+   bits > 32:  a single little endian stream of 64 bit words */
+class BitPacking {
+    public:
+        static unsigned width(uint64_t value) {
+            unsigned bits = 0;
+            while (bits < 64 && (value >> bits) != 0)
+                bits++;
+            return bits;
+        }
+
+        static size_t packedSize(size_t n, unsigned bits) {
+            if (bits <= 32) {
+                size_t positions = (n + 3) / 4;
+                return (positions * bits + 31) / 32 * 4 * sizeof(uint32_t);
+            }
+            return (n * bits + 63) / 64 * sizeof(uint64_t);
+        }
+
+        static void pack(const uint64_t* in, size_t n, unsigned bits, char* out) {
+            std::memset(out, 0, packedSize(n, bits));
+            if (bits == 0)
+                return;
+
+            if (bits <= 32) {
+                for (size_t i = 0; i < n; i++) {
+                    size_t offset = i / 4 * bits;
+                    size_t word = offset / 32 * 4 + i % 4;
+                    unsigned shift = offset % 32;
+                    orWord32(out, word, static_cast<uint32_t>(in[i] << shift));
+                    if (shift + bits > 32)
+                        orWord32(out, word + 4, static_cast<uint32_t>(in[i] >> (32 - shift)));
+                }
+                return;
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                size_t offset = i * bits;
+                unsigned shift = offset % 64;
+                orWord64(out, offset / 64, in[i] << shift);
+                if (shift + bits > 64)
+                    orWord64(out, offset / 64 + 1, in[i] >> (64 - shift));
+            }
+        }
+
+        static void unpack(const char* in, size_t n, unsigned bits, uint64_t* out) {
+            if (bits == 0) {
+                std::fill(out, out + n, 0);
+                return;
+            }
+
+            if (bits > 32) {
+                uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+                for (size_t i = 0; i < n; i++) {
+                    size_t offset = i * bits;
+                    unsigned shift = offset % 64;
+                    uint64_t value = word64(in, offset / 64) >> shift;
+                    if (shift + bits > 64)
+                        value |= word64(in, offset / 64 + 1) << (64 - shift);
+                    out[i] = value & mask;
+                }
+                return;
+            }
+
+            uint32_t mask = bits == 32 ? ~uint32_t(0) : (uint32_t(1) << bits) - 1;
+            size_t position = 0;
+#ifdef CODECS_SSE2
+            size_t full = n / 4;
+            const __m128i lanes = _mm_set1_epi32(mask);
+            const __m128i zero = _mm_setzero_si128();
+            for (; position < full; position++) {
+                size_t offset = position * bits;
+                const char* word = in + offset / 32 * 4 * sizeof(uint32_t);
+                unsigned shift = offset % 32;
+
+                __m128i values = _mm_srl_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(word)), _mm_cvtsi32_si128(shift));
+                if (shift + bits > 32) {
+                    __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word + 4 * sizeof(uint32_t)));
+                    values = _mm_or_si128(values, _mm_sll_epi32(next, _mm_cvtsi32_si128(32 - shift)));
+                }
+                values = _mm_and_si128(values, lanes);
+
+                // widens the four lanes to 64 bits
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + position * 4), _mm_unpacklo_epi32(values, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + position * 4 + 2), _mm_unpackhi_epi32(values, zero));
+            }
+#endif
+            for (; position * 4 < n; position++) {
+                size_t offset = position * bits;
+                unsigned shift = offset % 32;
+                for (size_t lane = 0; lane < 4 && position * 4 + lane < n; lane++) {
+                    size_t word = offset / 32 * 4 + lane;
+                    uint64_t value = word32(in, word) >> shift;
+                    if (shift + bits > 32)
+                        value |= static_cast<uint64_t>(word32(in, word + 4)) << (32 - shift);
+                    out[position * 4 + lane] = value & mask;
+                }
+            }
+        }
+
+    private:
+        static uint32_t word32(const char* in, size_t i) {
+            uint32_t w;
+            std::memcpy(&w, in + i * sizeof(uint32_t), sizeof(uint32_t));
+            return w;
+        }
+
+        static uint64_t word64(const char* in, size_t i) {
+            uint64_t w;
+            std::memcpy(&w, in + i * sizeof(uint64_t), sizeof(uint64_t));
+            return w;
+        }
+
+        static void orWord32(char* out, size_t i, uint32_t bits) {
+            uint32_t w = word32(out, i) | bits;
+            std::memcpy(out + i * sizeof(uint32_t), &w, sizeof(uint32_t));
+        }
+
+        static void orWord64(char* out, size_t i, uint64_t bits) {
+            uint64_t w = word64(out, i) | bits;
+            std::memcpy(out + i * sizeof(uint64_t), &w, sizeof(uint64_t));
+        }
+};
+
+// the values as they are, width bytes each
+struct RawCodec {
+    static void encode(const uint64_t* in, size_t n, size_t width, std::vector<char>& out) {
+        size_t start = out.size();
+        out.resize(start + n * width);
+        for (size_t i = 0; i < n; i++)
+            std::memcpy(&out[start + i * width], &in[i], width);
+    }
+
+    static const char* decode(const char* in, const char* end, size_t n, size_t width, uint64_t* out) {
+        if (static_cast<size_t>(end - in) < n * width)
+            throw std::runtime_error("truncated raw column");
+        for (size_t i = 0; i < n; i++) {
+            out[i] = 0;
+            std::memcpy(&out[i], in + i * width, width);
+        }
+        return in + n * width;
+    }
+};
+
+// the smallest value, followed by the bit packed distances to it
+struct FrameOfReferenceCodec {
+    static void encode(const uint64_t* in, size_t n, std::vector<char>& out) {
+        uint64_t reference = n == 0 ? 0 : *std::min_element(in, in + n);
+        std::vector<uint64_t> offsets(n);
+        uint64_t largest = 0;
+        for (size_t i = 0; i < n; i++) {
+            offsets[i] = in[i] - reference;
+            largest = std::max(largest, offsets[i]);
+        }
+        put(out, reference, offsets, BitPacking::width(largest));
+    }
+
+    static const char* decode(const char* in, const char* end, size_t n, uint64_t* out) {
+        uint64_t reference = VarInt::get(in, end);
+        if (in == end)
+            throw std::runtime_error("truncated frame of reference column");
+        unsigned bits = static_cast<uint8_t>(*in++);
+        if (bits > 64 || static_cast<size_t>(end - in) < BitPacking::packedSize(n, bits))
+            throw std::runtime_error("truncated frame of reference column");
+
+        BitPacking::unpack(in, n, bits, out);
+        for (size_t i = 0; i < n; i++)
+            out[i] += reference;
+        return in + BitPacking::packedSize(n, bits);
+    }
+
+    // shared with DeltaCodec, which packs its deltas the same way
+    static void put(std::vector<char>& out, uint64_t reference, const std::vector<uint64_t>& offsets, unsigned bits) {
+        VarInt::put(out, reference);
+        out.push_back(static_cast<char>(bits));
+        size_t start = out.size();
+        out.resize(start + BitPacking::packedSize(offsets.size(), bits));
+        BitPacking::pack(offsets.data(), offsets.size(), bits, &out[start]);
+    }
+};
+
+// the first value, followed by the differences between consecutive values
+// (zigzag encoded, so that small negative ones stay small) as a frame of reference
+class DeltaCodec {
+    public:
+        static void encode(const uint64_t* in, size_t n, std::vector<char>& out) {
+            VarInt::put(out, n == 0 ? 0 : in[0]);
+            std::vector<uint64_t> deltas(n == 0 ? 0 : n - 1);
+            for (size_t i = 1; i < n; i++)
+                deltas[i - 1] = zigzag(in[i] - in[i - 1]);
+            FrameOfReferenceCodec::encode(deltas.data(), deltas.size(), out);
+        }
+
+        static const char* decode(const char* in, const char* end, size_t n, uint64_t* out) {
+            uint64_t first = VarInt::get(in, end);
+            if (n == 0)
+                return FrameOfReferenceCodec::decode(in, end, 0, out);
+
+            in = FrameOfReferenceCodec::decode(in, end, n - 1, out + 1);
+            out[0] = first;
+            for (size_t i = 1; i < n; i++)
+                out[i] = out[i - 1] + unzigzag(out[i]);
+            return in;
+        }
+
+    private:
+        static uint64_t zigzag(uint64_t delta) {
+            return (delta << 1) ^ (0 - (delta >> 63));
+        }
+
+        static uint64_t unzigzag(uint64_t value) {
+            return (value >> 1) ^ (0 - (value & 1));
+        }
+};
+
+/* Byte oriented LZ77, for data with no integer structure
+   (varint) literal count, literals, (varint) match length, 0 at the end of the
+   input, and (varint) match distance back from the current position */
+class LZCodec {
+    public:
+        static constexpr size_t MIN_MATCH = 4;
+        static constexpr size_t HASH_BITS = 12;
+
+        static void encode(const char* in, size_t n, std::vector<char>& out) {
+            VarInt::put(out, n);
+            std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0); // positions + 1, 0 when empty
+
+            size_t i = 0, anchor = 0;
+            while (i + MIN_MATCH <= n) {
+                uint32_t h = hash(in + i);
+                size_t candidate = table[h];
+                table[h] = i + 1;
+                if (candidate == 0 || std::memcmp(in + candidate - 1, in + i, MIN_MATCH) != 0) {
+                    i++;
+                    continue;
+                }
+
+                size_t from = candidate - 1, length = MIN_MATCH;
+                while (i + length < n && in[from + length] == in[i + length])
+                    length++;
+
+                VarInt::put(out, i - anchor);
+                out.insert(out.end(), in + anchor, in + i);
+                VarInt::put(out, length);
+                VarInt::put(out, i - from);
+                i += length;
+                anchor = i;
+            }
+
+            VarInt::put(out, n - anchor);
+            out.insert(out.end(), in + anchor, in + n);
+            VarInt::put(out, 0);
+        }
+
+        // decodes into out, which must have room for the size given to encode
+        static const char* decode(const char* in, const char* end, char* out, size_t capacity) {
+            size_t n = VarInt::get(in, end);
+            if (n > capacity)
+                throw std::runtime_error("LZ block larger than expected");
+
+            size_t done = 0;
+            while (true) {
+                size_t literals = VarInt::get(in, end);
+                if (literals > static_cast<size_t>(end - in) || done + literals > n)
+                    throw std::runtime_error("corrupt LZ block");
+                std::copy(in, in + literals, out + done);
+                in += literals;
+                done += literals;
+
+                size_t length = VarInt::get(in, end);
+                if (length == 0)
+                    break;
+                size_t distance = VarInt::get(in, end);
+                if (distance == 0 || distance > done || done + length > n)
+                    throw std::runtime_error("corrupt LZ block");
+                for (size_t k = 0; k < length; k++, done++) // matches may overlap themselves
+                    out[done] = out[done - distance];
+            }
+
+            if (done != n)
+                throw std::runtime_error("corrupt LZ block");
+            return in;
+        }
+
+    private:
+        static uint32_t hash(const char* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(uint32_t));
+            return (v * 2654435761u) >> (32 - HASH_BITS);
+        }
+};
+
+// Encodes a column with whichever codec makes it smallest, tagging it with the codec used
+class ColumnCodec {
+    public:
+        enum Codec : uint8_t { RAW, FRAME_OF_REFERENCE, DELTA, LZ };
+
+        static void encode(const uint64_t* in, size_t n, size_t width, std::vector<char>& out) {
+            std::vector<char> bytes, best, candidate;
+            RawCodec::encode(in, n, width, bytes);
+            best.push_back(RAW);
+            best.insert(best.end(), bytes.begin(), bytes.end());
+
+            candidate.push_back(FRAME_OF_REFERENCE);
+            FrameOfReferenceCodec::encode(in, n, candidate);
+            keepSmaller(best, candidate);
+
+            candidate.assign(1, DELTA);
+            DeltaCodec::encode(in, n, candidate);
+            keepSmaller(best, candidate);
+
+            candidate.assign(1, LZ);
+            LZCodec::encode(bytes.data(), bytes.size(), candidate);
+            keepSmaller(best, candidate);
+
+            out.insert(out.end(), best.begin(), best.end());
+        }
+
+        static const char* decode(const char* in, const char* end, size_t n, size_t width, uint64_t* out) {
+            if (in == end)
+                throw std::runtime_error("truncated column");
+
+            uint8_t codec = *in++;
+            switch (codec) {
+                case RAW:
+                    return RawCodec::decode(in, end, n, width, out);
+                case FRAME_OF_REFERENCE:
+                    return FrameOfReferenceCodec::decode(in, end, n, out);
+                case DELTA:
+                    return DeltaCodec::decode(in, end, n, out);
+                case LZ: {
+                    std::vector<char> bytes(n * width);
+                    in = LZCodec::decode(in, end, bytes.data(), bytes.size());
+                    RawCodec::decode(bytes.data(), bytes.data() + bytes.size(), n, width, out);
+                    return in;
+                }
+                default:
+                    throw std::runtime_error("unknown column codec");
+            }
+        }
+
+    private:
+        static void keepSmaller(std::vector<char>& best, std::vector<char>& candidate) {
+            if (candidate.size() < best.size())
+                best.swap(candidate);
+        }
+};
+
+#endif
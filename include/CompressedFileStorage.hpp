@@ -0,0 +1,523 @@
+#ifndef COMPRESSEDFILESTORAGE_INCLUDED
+#define COMPRESSEDFILESTORAGE_INCLUDED
+
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "FileIO.hpp"
+#include "Checksum.hpp"
+#include "Codecs.hpp"
+#include "Serializers.hpp"
+
+/* FILE FORMAT
+   (FileHeader) header
+   (encoded blocks)[] appended as they are written. rewritten blocks leave their
+                      older versions behind as garbage, until compact() is called
+
+   BLOCK FORMAT
+   (uint8_t)[BLOCK_RECORDS / 8] valid flags, one bit per record
+   columns, each a ColumnCodec encoding of one field of every record. records are
+   split into fields of 8 or 4 bytes when their size allows it, and are kept
+   whole (as one LZ or raw column of bytes) otherwise
+
+   BLOCK INDEX FORMAT (path + ".idx", replaced whole by renaming a synced copy over it)
+   (IndexHeader) count of entries, and the generation, size, end and garbage of the
+                 data file they describe, with a CRC32C of these and of the entries
+   (BlockEntry)[] where each block is, with an offset of 0 for blocks never written
+
+   the index is written after the blocks it points to are synced, and before the
+   header, so its size, end and garbage are the ones trusted on open. compact()
+   replaces the index before the data file, so an index of the next generation
+   means the compacted file (path + ".compact") is renamed on open */
+
+// Stores constant size records in blocks of BLOCK_RECORDS records compressed as
+// a whole, for tables too large to keep raw. blocks are decoded into a small
+// cache on access, so random reads and writes cost a whole block each
+template <typename T,
+          class Serializer = BinarySerializer<T>>
+class CompressedFileStorage {
+    private:
+        typedef SerializerTraits<T, Serializer> Traits;
+
+    public:
+        static constexpr uint32_t MAGIC = 0x43465641;
+        static constexpr uint16_t VERSION = 2;
+        static constexpr size_t BLOCK_RECORDS = 1024;
+
+        typedef struct FileHeader {
+            FileHeader()
+                : magic(MAGIC), version(VERSION), reserved(0), recordSize(Serializer::size),
+                  blockRecords(BLOCK_RECORDS), size(0), end(sizeof(FileHeader)), garbage(0), generation(0), checksum(0) {}
+
+            uint32_t magic;
+            uint16_t version;
+            uint16_t reserved;
+            uint32_t recordSize;
+            uint32_t blockRecords;
+            uint64_t size;
+            uint64_t end;     // where the next block goes
+            uint64_t garbage; // bytes taken by older versions of blocks
+            uint32_t generation; // advanced by every compaction, and matched by the index
+            uint32_t checksum; // of every field above
+
+            uint32_t compute() const {
+                return CRC32C::compute(reinterpret_cast<const char*>(this), offsetof(FileHeader, checksum));
+            }
+
+            friend std::ostream& operator<<(std::ostream& os, const FileHeader& f) {
+                os << "size: " << f.size << std::endl;
+                os << "file: " << f.end << " bytes, " << f.garbage << " of them garbage";
+                return os;
+            }
+
+            operator const char*() const {
+                return reinterpret_cast<const char*>(this);
+            }
+        } FileHeader;
+
+        CompressedFileStorage(const std::string& path, size_t cacheBlocks = 16)
+            : file(path), cacheCapacity(std::max<size_t>(cacheBlocks, 1)), clock(0), dirty(false)
+        {
+            static_assert(Traits::constantSize, "Serializer must be a constant size serializer");
+
+            if (file.size() == 0) {
+                fileHeader = FileHeader();
+                writeHeader();
+            }
+            else
+                readHeader();
+            loadIndex();
+        }
+
+        virtual ~CompressedFileStorage() {
+            if (file.isOpen())
+                flush();
+        }
+
+        CompressedFileStorage(const CompressedFileStorage& other) = delete;
+        CompressedFileStorage& operator=(const CompressedFileStorage& other) = delete;
+
+        FileHeader header() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return fileHeader;
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return fileHeader.size;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        // bytes taken on disk by the current version of every block
+        size_t storedBytes() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return fileHeader.end - sizeof(FileHeader) - fileHeader.garbage;
+        }
+
+        bool valid(size_t index) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (index >= fileHeader.size)
+                return false;
+            return flag(block(index / BLOCK_RECORDS), index % BLOCK_RECORDS);
+        }
+
+        T read(size_t index) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            checkRange(index);
+            const Block& b = block(index / BLOCK_RECORDS);
+            return Traits::deserialize(b.records.data() + index % BLOCK_RECORDS * Serializer::size);
+        }
+
+        void write(const T& data, size_t index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            Block& b = block(index / BLOCK_RECORDS);
+            size_t slot = index % BLOCK_RECORDS;
+            Serializer::serialize(data, b.records.data() + slot * Serializer::size);
+            b.flags[slot / 8] |= 1 << (slot % 8);
+            b.dirty = true;
+
+            if (index >= fileHeader.size) {
+                fileHeader.size = index + 1;
+                dirty = true;
+            }
+        }
+
+        size_t append(const T& data) {
+            size_t index = size();
+            write(data, index);
+            return index;
+        }
+
+        void remove(size_t index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            checkRange(index);
+            Block& b = block(index / BLOCK_RECORDS);
+            size_t slot = index % BLOCK_RECORDS;
+            b.flags[slot / 8] &= ~(1 << (slot % 8));
+            std::fill_n(b.records.data() + slot * Serializer::size, Serializer::size, 0); // compresses better
+            b.dirty = true;
+        }
+
+        // calls visitor(index, data) on every valid record in [from, to). blocks are
+        // read whole, so only their compressed bytes come from the disk
+        template <typename Visitor>
+        void scan(size_t from, size_t to, Visitor visitor) const {
+            file.advise(Access::SEQUENTIAL);
+            for (size_t n = from / BLOCK_RECORDS; ; n++) {
+                Block b;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    to = std::min<size_t>(to, fileHeader.size);
+                    if (n * BLOCK_RECORDS >= to)
+                        break;
+
+                    auto cached = cache.find(n);
+                    if (cached != cache.end())
+                        b = cached->second;
+                    else
+                        load(n, b);
+                }
+
+                // the visitor runs unlocked, so that it can use the storage too
+                size_t first = std::max(from, n * BLOCK_RECORDS), last = std::min(to, (n + 1) * BLOCK_RECORDS);
+                for (size_t i = first; i < last; i++) {
+                    if (flag(b, i % BLOCK_RECORDS))
+                        visitor(i, Traits::deserialize(b.records.data() + i % BLOCK_RECORDS * Serializer::size));
+                }
+            }
+        }
+
+        // writes the changed blocks, the block index and the header back to the file
+        void flush() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& cached : cache)
+                store(cached.first, cached.second);
+            if (dirty) {
+                file.datasync(); // the blocks reach the disk before the index pointing to them
+                writeIndex();
+                writeHeader();
+            }
+        }
+
+        void sync() {
+            flush();
+            std::lock_guard<std::mutex> lock(mutex);
+            file.sync();
+        }
+
+        // rewrites the file with only the current version of each block. the index of
+        // the compacted file replaces the old one before the file itself does, so that a
+        // crash in between is finished by the next open
+        void compact() {
+            flush();
+            std::lock_guard<std::mutex> lock(mutex);
+            std::string path = file.name();
+            std::vector<BlockEntry> moved = index;
+            FileHeader compactedHeader = fileHeader;
+            {
+                File compacted(compactedPath(), O_RDWR | O_CREAT | O_TRUNC);
+                size_t end = sizeof(FileHeader);
+                std::vector<char> data;
+                for (BlockEntry& entry : moved) {
+                    if (entry.offset == 0)
+                        continue;
+                    data.resize(entry.length);
+                    file.read(entry.offset, data.data(), data.size());
+                    compacted.write(end, data.data(), data.size());
+                    entry.offset = end;
+                    end += entry.length;
+                }
+
+                compactedHeader.end = end;
+                compactedHeader.garbage = 0;
+                compactedHeader.generation++;
+                compactedHeader.checksum = compactedHeader.compute();
+                compacted.write(0, compactedHeader, sizeof(FileHeader));
+                compacted.sync();
+            }
+
+            index = moved;
+            fileHeader = compactedHeader;
+            writeIndex();
+            if (std::rename(compactedPath().c_str(), path.c_str()) != 0)
+                throw std::runtime_error("could not replace " + path + ": " + std::strerror(errno));
+            file = File(path);
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const CompressedFileStorage<T, Serializer>& s) {
+            os << s.header() << std::endl;
+            s.scan(0, s.size(), [&os] (size_t index, const T& data) {
+                os << index << ": " << data << std::endl;
+            });
+            return os;
+        }
+
+    private:
+        struct BlockEntry {
+            uint64_t offset;
+            uint32_t length;
+            uint32_t checksum;
+        };
+
+        struct IndexHeader {
+            uint64_t count;
+            uint64_t size;
+            uint64_t end;
+            uint64_t garbage;
+            uint32_t generation;
+            uint32_t checksum; // of every field above and of the entries
+        };
+
+        // a decoded block
+        struct Block {
+            std::vector<char> records;
+            std::vector<uint8_t> flags;
+            bool dirty = false;
+            uint64_t used = 0; // for least recently used eviction
+        };
+
+        File file;
+        FileHeader fileHeader;
+        mutable std::mutex mutex;
+
+        std::vector<BlockEntry> index;
+
+        mutable std::map<size_t, Block> cache;
+        size_t cacheCapacity;
+        mutable uint64_t clock;
+
+        bool dirty; // whether the header and index changed since the last flush
+
+        // records are split into the widest fields that divide them
+        static constexpr size_t fieldWidth() {
+            return Serializer::size % 8 == 0 ? 8 : Serializer::size % 4 == 0 ? 4 : 0;
+        }
+
+        static bool flag(const Block& b, size_t slot) {
+            return b.flags[slot / 8] & (1 << (slot % 8));
+        }
+
+        std::string indexPath() const {
+            return file.name() + ".idx";
+        }
+
+        std::string compactedPath() const {
+            return file.name() + ".compact";
+        }
+
+        void checkRange(size_t index) const {
+            if (index >= fileHeader.size)
+                throw std::out_of_range("record index out of range");
+        }
+
+        // the cached block n, decoded from the file if needed
+        Block& block(size_t n) const {
+            auto cached = cache.find(n);
+            if (cached == cache.end()) {
+                if (cache.size() >= cacheCapacity)
+                    evict();
+                cached = cache.emplace(n, Block()).first;
+                load(n, cached->second);
+            }
+
+            cached->second.used = ++clock;
+            return cached->second;
+        }
+
+        void evict() const {
+            auto victim = std::min_element(cache.begin(), cache.end(), [] (const auto& a, const auto& b) {
+                return a.second.used < b.second.used;
+            });
+            // storing a block does not change any record, so reads may evict too
+            const_cast<CompressedFileStorage*>(this)->store(victim->first, victim->second);
+            cache.erase(victim);
+        }
+
+        void load(size_t n, Block& b) const {
+            b.records.assign(BLOCK_RECORDS * Serializer::size, 0);
+            b.flags.assign(BLOCK_RECORDS / 8, 0);
+            b.dirty = false;
+            if (n >= index.size() || index[n].offset == 0)
+                return;
+
+            const BlockEntry& entry = index[n];
+            std::vector<char> data(entry.length);
+            if (file.read(entry.offset, data.data(), data.size()) < data.size() ||
+                CRC32C::compute(data.data(), data.size()) != entry.checksum)
+                throw std::runtime_error("corrupt block " + std::to_string(n) + " in " + file.name());
+            decode(data, b);
+        }
+
+        // appends a changed block to the file
+        void store(size_t n, Block& b) {
+            if (!b.dirty)
+                return;
+
+            std::vector<char> data = encode(b);
+            if (n >= index.size())
+                index.resize(n + 1, BlockEntry{0, 0, 0});
+            fileHeader.garbage += index[n].length;
+
+            file.write(fileHeader.end, data.data(), data.size());
+            index[n] = BlockEntry{fileHeader.end, static_cast<uint32_t>(data.size()), CRC32C::compute(data.data(), data.size())};
+            fileHeader.end += data.size();
+            b.dirty = false;
+            dirty = true;
+        }
+
+        static std::vector<char> encode(const Block& b) {
+            std::vector<char> out(b.flags.begin(), b.flags.end());
+            const size_t width = fieldWidth();
+            if (width == 0) {
+                std::vector<char> whole;
+                LZCodec::encode(b.records.data(), b.records.size(), whole);
+                bool compressed = whole.size() < b.records.size();
+                out.push_back(compressed);
+                out.insert(out.end(), compressed ? whole.begin() : b.records.begin(), compressed ? whole.end() : b.records.end());
+                return out;
+            }
+
+            std::vector<uint64_t> column(BLOCK_RECORDS);
+            for (size_t field = 0; field < Serializer::size / width; field++) {
+                for (size_t i = 0; i < BLOCK_RECORDS; i++) {
+                    column[i] = 0;
+                    std::memcpy(&column[i], b.records.data() + i * Serializer::size + field * width, width);
+                }
+                ColumnCodec::encode(column.data(), column.size(), width, out);
+            }
+            return out;
+        }
+
+        static void decode(const std::vector<char>& data, Block& b) {
+            const char* in = data.data();
+            const char* end = data.data() + data.size();
+            if (data.size() < b.flags.size())
+                throw std::runtime_error("truncated block");
+            std::copy(in, in + b.flags.size(), b.flags.begin());
+            in += b.flags.size();
+
+            const size_t width = fieldWidth();
+            if (width == 0) {
+                if (in == end)
+                    throw std::runtime_error("truncated block");
+                if (*in++)
+                    LZCodec::decode(in, end, b.records.data(), b.records.size());
+                else if (static_cast<size_t>(end - in) == b.records.size())
+                    std::copy(in, end, b.records.begin());
+                else
+                    throw std::runtime_error("truncated block");
+                return;
+            }
+
+            std::vector<uint64_t> column(BLOCK_RECORDS);
+            for (size_t field = 0; field < Serializer::size / width; field++) {
+                in = ColumnCodec::decode(in, end, column.size(), width, column.data());
+                for (size_t i = 0; i < BLOCK_RECORDS; i++)
+                    std::memcpy(b.records.data() + i * Serializer::size + field * width, &column[i], width);
+            }
+        }
+
+        static uint32_t indexChecksum(const IndexHeader& h, const std::vector<BlockEntry>& entries) {
+            uint32_t crc = CRC32C::compute(reinterpret_cast<const char*>(&h), offsetof(IndexHeader, checksum));
+            return CRC32C::compute(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(BlockEntry), crc);
+        }
+
+        // reads and checks the index, which may be newer than the header but never older
+        void loadIndex() {
+            if (::access(indexPath().c_str(), F_OK) != 0)
+                return;
+
+            File indexFile(indexPath());
+            IndexHeader h;
+            if (indexFile.read(0, reinterpret_cast<char*>(&h), sizeof(IndexHeader)) < sizeof(IndexHeader) ||
+                h.count > indexFile.size() / sizeof(BlockEntry) ||
+                indexFile.size() != sizeof(IndexHeader) + h.count * sizeof(BlockEntry))
+                throw std::runtime_error("corrupt block index in " + indexPath());
+            index.resize(h.count);
+            indexFile.read(sizeof(IndexHeader), reinterpret_cast<char*>(index.data()), h.count * sizeof(BlockEntry));
+            if (h.checksum != indexChecksum(h, index))
+                throw std::runtime_error("corrupt block index in " + indexPath());
+
+            if (h.generation != fileHeader.generation)
+                finishCompaction(h.generation);
+            for (const BlockEntry& entry : index) {
+                if (entry.offset != 0 && (entry.offset < sizeof(FileHeader) || entry.offset + entry.length > h.end))
+                    throw std::runtime_error("corrupt block index in " + indexPath());
+            }
+
+            fileHeader.size = h.size;
+            fileHeader.end = h.end;
+            fileHeader.garbage = h.garbage;
+        }
+
+        // renames the compacted file a crash left behind, once its index was in place
+        void finishCompaction(uint32_t generation) {
+            std::string path = file.name();
+            if (::access(compactedPath().c_str(), F_OK) == 0) {
+                File compacted(compactedPath());
+                FileHeader h;
+                if (compacted.read(0, reinterpret_cast<char*>(&h), sizeof(FileHeader)) == sizeof(FileHeader) &&
+                    h.magic == MAGIC && h.checksum == h.compute() && h.generation == generation) {
+                    if (std::rename(compactedPath().c_str(), path.c_str()) != 0)
+                        throw std::runtime_error("could not replace " + path + ": " + std::strerror(errno));
+                    file = File(path);
+                    readHeader();
+                    return;
+                }
+            }
+            throw std::runtime_error("the block index of " + path + " belongs to another version of it");
+        }
+
+        // writes a synced copy of the index and renames it over the old one
+        void writeIndex() {
+            IndexHeader h;
+            h.count = index.size();
+            h.size = fileHeader.size;
+            h.end = fileHeader.end;
+            h.garbage = fileHeader.garbage;
+            h.generation = fileHeader.generation;
+            h.checksum = indexChecksum(h, index);
+
+            std::string temporary = indexPath() + ".tmp";
+            {
+                File indexFile(temporary, O_RDWR | O_CREAT | O_TRUNC);
+                indexFile.write(0, reinterpret_cast<const char*>(&h), sizeof(IndexHeader));
+                indexFile.write(sizeof(IndexHeader), reinterpret_cast<const char*>(index.data()), index.size() * sizeof(BlockEntry));
+                indexFile.sync();
+            }
+            if (std::rename(temporary.c_str(), indexPath().c_str()) != 0)
+                throw std::runtime_error("could not replace " + indexPath() + ": " + std::strerror(errno));
+        }
+
+        void readHeader() {
+            if (file.read(0, reinterpret_cast<char*>(&fileHeader), sizeof(FileHeader)) < sizeof(FileHeader) ||
+                fileHeader.magic != MAGIC)
+                throw std::runtime_error(file.name() + " is not a compressed storage file");
+            if (fileHeader.version != VERSION)
+                throw std::runtime_error(file.name() + " has unsupported format version " + std::to_string(fileHeader.version));
+            if (fileHeader.checksum != fileHeader.compute())
+                throw std::runtime_error("corrupt header in " + file.name());
+            if (fileHeader.recordSize != Serializer::size || fileHeader.blockRecords != BLOCK_RECORDS)
+                throw std::runtime_error(file.name() + " holds records of another type");
+        }
+
+        void writeHeader() {
+            fileHeader.checksum = fileHeader.compute();
+            file.write(0, fileHeader, sizeof(FileHeader));
+            dirty = false;
+        }
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef FILEIO_INCLUDED
+#define FILEIO_INCLUDED
+
+#include <string>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// access pattern hints, forwarded to posix_fadvise or madvise
+enum class Access { NORMAL, SEQUENTIAL, RANDOM };
+
+// Thin RAII wrapper around a POSIX file descriptor, using positioned I/O only
+// so that one descriptor can be shared by every read and write on a file
+class File {
+    private:
+        int fd;
+        std::string path;
+
+        void fail(const std::string& what) const {
+            throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+        }
+
+    public:
+        File() : fd(-1) {}
+
+        File(const std::string& path, int flags = O_RDWR | O_CREAT) : path(path) {
+            fd = ::open(path.c_str(), flags, 0644);
+            if (fd < 0)
+                fail("could not open");
+        }
+
+        virtual ~File() {
+            close();
+        }
+
+        File(const File& other) = delete;
+        File& operator=(const File& other) = delete;
+
+        File(File&& other) : fd(other.fd), path(std::move(other.path)) {
+            other.fd = -1;
+        }
+
+        File& operator=(File&& other) {
+            std::swap(fd, other.fd);
+            std::swap(path, other.path);
+            return *this;
+        }
+
+        void close() {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+
+        bool isOpen() const {
+            return fd >= 0;
+        }
+
+        int descriptor() const {
+            return fd;
+        }
+
+        const std::string& name() const {
+            return path;
+        }
+
+        size_t size() const {
+            struct stat st;
+            if (::fstat(fd, &st) < 0)
+                fail("could not stat");
+            return st.st_size;
+        }
+
+        // reads up to n bytes at offset, returns how many were read (short on EOF)
+        size_t read(size_t offset, char* out, size_t n) const {
+            size_t done = 0;
+            while (done < n) {
+                ssize_t r = ::pread(fd, out + done, n - done, offset + done);
+                if (r < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    fail("could not read");
+                }
+                if (r == 0)
+                    break;
+                done += r;
+            }
+            return done;
+        }
+
+        void write(size_t offset, const char* in, size_t n) {
+            size_t done = 0;
+            while (done < n) {
+                ssize_t w = ::pwrite(fd, in + done, n - done, offset + done);
+                if (w < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    fail("could not write");
+                }
+                done += w;
+            }
+        }
+
+        void truncate(size_t size) {
+            if (::ftruncate(fd, size) < 0)
+                fail("could not truncate");
+        }
+
+        void sync() {
+            if (::fsync(fd) < 0)
+                fail("could not sync");
+        }
+
+        void datasync() {
+            if (::fdatasync(fd) < 0)
+                fail("could not sync");
+        }
+
+        void advise(Access access, size_t offset = 0, size_t n = 0) const {
+            int advice = access == Access::SEQUENTIAL ? POSIX_FADV_SEQUENTIAL :
+                         access == Access::RANDOM ? POSIX_FADV_RANDOM : POSIX_FADV_NORMAL;
+            ::posix_fadvise(fd, offset, n, advice);
+        }
+};
+
+// Shared read-write mapping of the first size() bytes of a file, or a private one,
+// whose writes stay in memory, for files opened read only
+class Mapping {
+    private:
+        char* data;
+        size_t length;
+
+    public:
+        Mapping() : data(nullptr), length(0) {}
+
+        Mapping(File& file, size_t length, bool shared = true) : Mapping() {
+            map(file, length, shared);
+        }
+
+        virtual ~Mapping() {
+            unmap();
+        }
+
+        Mapping(const Mapping& other) = delete;
+        Mapping& operator=(const Mapping& other) = delete;
+
+        Mapping(Mapping&& other) : data(other.data), length(other.length) {
+            other.data = nullptr;
+            other.length = 0;
+        }
+
+        Mapping& operator=(Mapping&& other) {
+            std::swap(data, other.data);
+            std::swap(length, other.length);
+            return *this;
+        }
+
+        // maps the file, growing it first if it is shorter than length and shared
+        void map(File& file, size_t length, bool shared = true) {
+            if (shared && file.size() < length)
+                file.truncate(length);
+
+            void* ptr;
+            if (data == nullptr)
+                ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, file.descriptor(), 0);
+            else
+                ptr = ::mremap(data, this->length, length, MREMAP_MAYMOVE);
+
+            if (ptr == MAP_FAILED)
+                throw std::runtime_error("could not map " + file.name() + ": " + std::strerror(errno));
+
+            data = static_cast<char*>(ptr);
+            this->length = length;
+        }
+
+        void unmap() {
+            if (data != nullptr)
+                ::munmap(data, length);
+            data = nullptr;
+            length = 0;
+        }
+
+        bool mapped() const {
+            return data != nullptr;
+        }
+
+        char* get() const {
+            return data;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+        // writes the dirty pages back to the file, waiting for completion
+        void sync() {
+            if (data != nullptr && ::msync(data, length, MS_SYNC) < 0)
+                throw std::runtime_error(std::string("could not sync mapping: ") + std::strerror(errno));
+        }
+
+        void advise(Access access, size_t offset = 0, size_t n = 0) const {
+            if (data == nullptr)
+                return;
+
+            // madvise needs a page aligned start
+            size_t page = ::sysconf(_SC_PAGESIZE);
+            size_t start = offset - offset % page;
+            if (n == 0 || start + n + offset % page > length)
+                n = length - start;
+            else
+                n += offset % page;
+
+            int advice = access == Access::SEQUENTIAL ? MADV_SEQUENTIAL :
+                         access == Access::RANDOM ? MADV_RANDOM : MADV_NORMAL;
+            ::madvise(data + start, n, advice);
+        }
+};
+
+#endif
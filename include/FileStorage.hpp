@@ -5,86 +5,97 @@
 #include <memory>
 #include <algorithm>
 #include <type_traits>
-#include <fstream>
+#include <iostream>
 #include <stdexcept>
-#include <cstdio>
+#include <vector>
 #include <set>
+#include <map>
+#include <limits>
+#include <mutex>
+#include <future>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 
-/* FILE FORMAT
-   (flags) flags
-   (sizeof(T) + sizeof(bool))[] data */
+#include "FileIO.hpp"
+#include "Checksum.hpp"
+#include "Serializers.hpp"
+#include "WriteAheadLog.hpp"
+#include "AsyncIO.hpp"
+#include "BufferPool.hpp"
 
-// Only serializers constant size objects
-template <typename T>
-class ConstantSizeSerializer
-{
-    public:
-        std::unique_ptr<char> allocate_ptr() const {
-            return std::unique_ptr<char>(new char[serialize_size()]);
-        }
-        
-        std::unique_ptr<char> serialize(const T& in) const {
-            std::unique_ptr<char> ret(allocate_ptr());
-            serialize(in, ret.get());
-            return ret;
-        }
+/* FILE FORMAT (version 2)
+   (FileHeader) header, padded to pageSize()
+   (pageSize())[] pages of recordsPerPage() records, each made of
+       (PageHeader) CRC32C of the rest of the page and the page number
+       (uint8_t)[] valid flags, one bit per record, padded to the alignment of T
+       (Serializer::size)[] records
 
-        T deserialize(const std::unique_ptr<char>& in) const {
-            return deserialize(in.get());
-        }
+   pages are checked whenever they are read from the file. a page that was never
+   written reads as all zeros, and is an empty page rather than a corrupt one.
+   unless the file is mapped, pages are cached in a BufferPool, and changed ones
+   are written back when evicted or flushed. scans read around the pool, so that
+   they do not push every other page out of it. mapped pages are changed in place
+   and only sealed on flush, so before the first change of a page the header is
+   marked not clean and the page is listed in path + ".dirty". when a file is opened
+   not clean, only the listed pages are sealed again
 
-        T deserialize(const char* in) const {
-            T out;
-            deserialize(in, out);
-            return out;
-        }
+   FREE LIST FORMAT (path + ".free")
+   (size_t) count
+   (size_t)[] free record indexes
 
-        virtual size_t serialize_size() const = 0;
-        virtual void serialize(const T& in, char* out) const = 0;
-        virtual void deserialize(const char* in, T& out) const = 0;
-};
+   DIRTY PAGE LIST FORMAT (path + ".dirty")
+   (uint32_t)[] pages of the mapping changed since it was last synced
 
-template <typename T>
-class BinarySerializer : public ConstantSizeSerializer<T> {
-    public:
-        using ConstantSizeSerializer<T>::deserialize;
-        using ConstantSizeSerializer<T>::serialize;
-
-        virtual size_t serialize_size() const override {
-            return sizeof(T);
-        }
-
-        virtual void serialize(const T& in, char* out) const override {
-            const char* data = reinterpret_cast<const char*>(&in);
-            std::copy(data, data+serialize_size(), out);
-        }
-
-        virtual void deserialize(const char* in, T& out) const override {
-            out = *reinterpret_cast<const T*>(in);
-        }
-};
+   LOG ENTRY FORMAT (path + ".wal", see WriteAheadLog)
+   (uint64_t) index, or the new size for resizes
+   (uint8_t) entry type
+   (Serializer::size)? the record, for writes only */
 
 template <typename T,
           class Serializer = BinarySerializer<T>> 
-class FileStorage {
+class FileStorage : private BufferPool::Client {
     private:
-        const Serializer serializer;
+        typedef SerializerTraits<T, Serializer> Traits;
+
+        class Scanner;
 
     public:
+        static constexpr uint32_t MAGIC = 0x53465641;
+        static constexpr uint16_t VERSION = 2;
+
+        // pages span a whole number of these, so that they line up with the page cache
+        static constexpr size_t PAGE_SIZE = 4096;
+
         typedef struct FileHeader {
             FileHeader(size_t size = 0, bool clean = true) 
-                : size(size), clean(clean) {}
+                : magic(MAGIC), version(VERSION), reserved(0), pageSize(FileStorage::pageSize()),
+                  recordSize(Serializer::size), size(size), clean(clean), padding{}, checksum(0) {}
 
+            uint32_t magic;
+            uint16_t version;
+            uint16_t reserved;
+            uint32_t pageSize;
+            uint32_t recordSize;
+            uint64_t size;
             bool clean;
-            size_t size;
+            uint8_t padding[3];
+            uint32_t checksum; // of every field above
 
-            friend std::ostream operator<<(std::ostream& os, const FileHeader& f) {
+            uint32_t compute() const {
+                return CRC32C::compute(reinterpret_cast<const char*>(this), offsetof(FileHeader, checksum));
+            }
+
+            friend std::ostream& operator<<(std::ostream& os, const FileHeader& f) {
+                os << "version: " << f.version << std::endl;
                 if (f.clean)
                     os << "clean" << std::endl;
                 else
                     os << "not clean" << std::endl;
 
-                os << "size: " << f.size << std::endl;
+                os << "size: " << f.size;
+                return os;
             }
 
             operator const char*() const {
@@ -92,175 +103,1206 @@ class FileStorage {
             }
         } FileHeader;
 
-        template <typename RType>
-        struct Register {
-            Register() : Register(RType()) {}
-            Register(const T& data) : valid(true), data(data) {}
+        enum Flags : unsigned int {
+            DEFAULT = 0,
+            MAPPED = 1 << 0, // maps the whole file instead of going through pread/pwrite
+            LOGGED = 1 << 1  // logs every change to path + ".wal", making them durable on commit()
+        };
 
-            bool valid;
-            const RType& data;
+        // mapped files grow by whole chunks to keep remaps rare
+        static constexpr size_t MAP_CHUNK = 1 << 20;
 
-            template <typename U>
-            friend std::ostream operator<<(std::ostream& os, const Register<U>& r) {
-                if (r.valid)
-                    os << "valid";
-                else
-                    os << "invalid";
-                os << " " << r.data;
-            }
+        // logged storages checkpoint once their log grows past this
+        static constexpr size_t CHECKPOINT_BYTES = 64 << 20;
 
-            operator const char*() const {
-                Serializer serializer;
-                return (std::string(1, (char)valid) + 
-                       std::string(serializer.serialize(data).get())).c_str();
+        // most records moved by a single request of a batch
+        static constexpr size_t BATCH_RECORDS = 4096;
+
+        // bytes read at once by scans, with the following block read ahead
+        static constexpr size_t SCAN_BLOCK_BYTES = 1 << 20;
+
+        // pages are cached in pool, shared by every storage unless another one is given
+        FileStorage(const std::string& path, unsigned int flags = DEFAULT, BufferPool& pool = BufferPool::shared())
+            : file(path), checkpointBytes(CHECKPOINT_BYTES), freeSlotsDirty(false), pool(pool),
+              headerDirty(false), recovering(false)
+        {
+            static_assert(Traits::constantSize, "Serializer must be a constant size serializer");
+
+            if (file.size() == 0) { // if file is new, creates its header
+                fileHeader = FileHeader();
+                writeHeader();
             }
+            else
+                readHeader();
+
+            try {
+                // the last run crashed before checkpointing, or with mapped pages changed since a flush
+                bool crashed = !fileHeader.clean;
+                if (crashed)
+                    reseal();
+
+                if (flags & LOGGED) {
+                    log.reset(new WriteAheadLog(path + ".wal"));
+                    recovering = crashed;
+                    if (recovering)
+                        replay();
+                }
 
-            char* c_ptr() {
-                return reinterpret_cast<char*>(&valid);
+                if (flags & MAPPED) {
+                    dirtyList = File(path + ".dirty");
+                    dirtyList.truncate(0);
+                    mapping.map(file, mappedLength(fileHeader.size));
+                    pool.discard(*this); // pages replayed through the pool are in the mapping now
+                }
+
+                if (recovering) {
+                    rebuildFreeSlots();
+                    checkpoint();
+                    recovering = false;
+                }
+                else if (crashed) { // the free list may be stale, which reuse and compaction tolerate
+                    loadFreeSlots();
+                    fileHeader.clean = true;
+                    writeHeader();
+                }
+                else
+                    loadFreeSlots();
+            } catch (...) { // no page may outlive the storage in the pool
+                pool.discard(*this);
+                throw;
             }
-        };
+        }
 
-        FileStorage(std::string path) : path(path)
-        {
-            static_assert(std::is_base_of<ConstantSizeSerializer<T>, Serializer>::value, 
-                          "Serializer must derive from DataSerializer");
+        virtual ~FileStorage() {
+            if (!file.isOpen())
+                return;
 
-            using std::ofstream;
+            if (log)
+                checkpoint();
+            else
+                flush();
+            pool.discard(*this);
 
-            ofstream file(path, std::ifstream::binary);
-            if (!file.good()) { // if file does not exist, creates it
-                file.open(path, ofstream::out | ofstream::binary | ofstream::trunc);
-                writeHeader(file, FileHeader());
+            if (mapping.mapped()) { // drops the unused tail of the last chunk
+                mapping.unmap();
+                file.truncate(pageOffset(pageCount(fileHeader.size)));
             }
         }
 
-        FileHeader header() {
-            std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
-            return header(file);
+        FileStorage(const FileStorage& other) = delete;
+        FileStorage& operator=(const FileStorage& other) = delete;
+
+        FileHeader header() const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            return fileHeader;
         }
 
-        bool clean() {
+        bool clean() const {
             return header().clean;
         }
 
-        bool empty() {
-            return header().size == 0;
+        bool empty() const {
+            return size() == 0;
+        }
+
+        // records held by each page, so that readers can line blocks up with pages
+        static constexpr size_t blockRecords() {
+            return recordsPerPage();
+        }
+
+        size_t size() const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            return fileHeader.size;
+        }
+
+        bool logged() const {
+            return log != nullptr;
+        }
+
+        bool mapped() const {
+            return mapping.mapped();
+        }
+
+        bool valid(size_t index) const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            if (index >= fileHeader.size)
+                return false;
+
+            size_t page = pageOf(index);
+            if (mapped())
+                return flag(memoryPage(page), slotOf(index));
+            return flag(pinPage(page).data(), slotOf(index));
         }
 
         void remove(size_t index) {
-            std::ofstream file(path, std::ofstream::binary);
-            setOutPosition(file, index);
-            if (!file.eof())
-                file << false;
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            checkRange(index);
+            freeSlots.insert(index);
+            freeSlotsDirty = true;
+            logEntry(REMOVE_ENTRY, index);
+            BufferPool::Page page = writablePage(pageOf(index));
+            setFlag(page.data(), slotOf(index), false);
         }
 
         void write(const T& data, size_t index = 0) {
-            std::ofstream file(path, std::ofstream::out | std::ofstream::binary);
-            setOutPosition(file, index);
-            file.write(Register<T>(data), sizeof(Register<T>));
-        }
-
-        T read(size_t index) {
-            std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
-            Register<T> r(readln(file, index));
-            return r.data;
-        }
-
-        std::set<size_t> rewrite() {
-            std::fstream file(path);
-            std::string tmpFilePath = tmpnam(nullptr);
-            std::fstream tmp(tmpFilePath, std::fstream::out | std::fstream::trunc);
-
-            // copies file flags to temporary file
-            writeHeader(tmp, FileHeader(true, header().size));
-            // positions read cursor at first record
-            setInPosition(file, 0);
-
-            std::set<size_t> invalidatedIndexes;
-            size_t index = 0;
-            while (!file.eof()) {
-                bool valid;
-                std::unique_ptr<char> data;
-                file >> valid;
-                file.read(data, serializer.serialize_size());
-                if (valid) {
-                    tmp << true;
-                    tmp.write(serializer.serialize(data), serializer.serialize_size());
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            BufferPool::Page page = writablePage(pageOf(index));
+            char* record = page.data() + recordStart(slotOf(index));
+            setFlag(page.data(), slotOf(index), true);
+            Serializer::serialize(data, record);
+            logEntry(WRITE_ENTRY, index, record);
+            grow(index + 1);
+        }
+
+        size_t append(const T& data) {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            size_t index = fileHeader.size;
+            write(data, index);
+            return index;
+        }
+
+        // writes into the lowest free slot, appending only if there is none
+        size_t insert(const T& data) {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            size_t index = takeFreeSlot();
+            write(data, index);
+            return index;
+        }
+
+        size_t freeCount() const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            return freeSlots.size();
+        }
+
+        T read(size_t index) const {
+            size_t page = pageOf(index);
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                checkRange(index);
+                if (mapped())
+                    return Traits::deserialize(memoryPage(page) + recordStart(slotOf(index)));
+                BufferPool::Page resident = pool.pinResident(client(), page);
+                if (resident)
+                    return Traits::deserialize(resident.data() + recordStart(slotOf(index)));
+            }
+
+            // the lock is not held while reading, so other threads can have I/O in flight
+            // too. the page is looked into under the lock, since writers change it in place
+            BufferPool::Page loaded = pinPage(page);
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            return Traits::deserialize(loaded.data() + recordStart(slotOf(index)));
+        }
+
+        std::future<T> readAsync(size_t index) const {
+            return AsyncIO::shared().pool().submit([this, index] { return read(index); });
+        }
+
+        std::future<void> writeAsync(const T& data, size_t index) {
+            return AsyncIO::shared().pool().submit([this, data, index] { write(data, index); });
+        }
+
+        // reads many records at once, in the order of indices. the pages missing from
+        // the pool are read sorted, with runs of adjacent ones merged into single requests
+        std::vector<T> readBatch(const std::vector<size_t>& indices) const {
+            std::vector<T> ret(indices.size());
+            std::map<size_t, std::vector<size_t>> pending; // page -> positions in indices
+            std::vector<uint64_t> stamps;
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                BufferPool::Page resident; // of the last index, which the next one often shares
+                for (size_t i = 0; i < indices.size(); i++) {
+                    checkRange(indices[i]);
+                    size_t page = pageOf(indices[i]);
+                    if (mapped()) {
+                        ret[i] = Traits::deserialize(memoryPage(page) + recordStart(slotOf(indices[i])));
+                        continue;
+                    }
+
+                    auto missing = pending.find(page);
+                    if (missing != pending.end()) {
+                        missing->second.push_back(i);
+                        continue;
+                    }
+                    if (!resident || resident.number() != page)
+                        resident = pool.pinResident(client(), page);
+                    if (resident)
+                        ret[i] = Traits::deserialize(resident.data() + recordStart(slotOf(indices[i])));
+                    else
+                        pending[page].push_back(i);
                 }
-                else
-                    invalidatedIndexes.insert(index);
+                for (const auto& missing : pending)
+                    stamps.push_back(pool.stamp(client(), missing.first));
+            }
+            if (pending.empty())
+                return ret;
+
+            std::vector<size_t> pages;
+            for (const auto& missing : pending)
+                pages.push_back(missing.first);
+
+            // runs[r] holds the pages from pages[runStarts[r]] on
+            size_t runPages = std::max<size_t>(BATCH_RECORDS / recordsPerPage(), 1);
+            std::vector<std::vector<char>> runs;
+            std::vector<size_t> runStarts;
+            std::vector<IORequest> requests;
+            for (size_t i = 0; i < pages.size(); ) {
+                size_t j = i + 1;
+                while (j < pages.size() && pages[j] == pages[j - 1] + 1 && j - i < runPages)
+                    j++;
 
-                index++;
+                runs.emplace_back((j - i) * pageSize());
+                runStarts.push_back(i);
+                i = j;
             }
+            for (size_t r = 0; r < runs.size(); r++)
+                requests.emplace_back(runs[r].data(), pageOffset(pages[runStarts[r]]), runs[r].size());
 
-            // reopens both files and copies temporary file content into other file
-            file.open(path, std::fstream::out | std::fstream::trunc);
-            file.open(tmpFilePath, std::fstream::in);
-            file << tmp.rdbuf();
+            AsyncIO::shared().run(file, requests);
 
-            // deletes temporary file
-            tmp.close();
-            remove(tmpFilePath);
+            // the pages read go into the pool, unless a newer version was written meanwhile
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            size_t p = 0;
+            for (size_t r = 0; r < runs.size(); r++) {
+                for (size_t offset = 0; offset < runs[r].size(); offset += pageSize(), p++) {
+                    const char* data = runs[r].data() + offset;
+                    BufferPool::Page page = pool.install(client(), pages[p], intact(pages[p], data) ? data : nullptr, stamps[p]);
+                    for (size_t i : pending[pages[p]])
+                        ret[i] = Traits::deserialize(page.data() + recordStart(slotOf(indices[i])));
+                }
+            }
+
+            return ret;
+        }
 
-            return invalidatedIndexes;
+        // writes the records in [first, last) to consecutive indexes starting at index
+        template <class InputIt>
+        void writeBatch(size_t index, InputIt first, InputIt last) {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            std::vector<T> records(first, last);
+            size_t count = records.size();
+            if (count == 0)
+                return;
+
+            // records are contiguous inside a page, so each page takes a single copy
+            for (size_t done = 0; done < count; ) {
+                size_t slot = slotOf(index + done);
+                size_t n = std::min(recordsPerPage() - slot, count - done);
+                BufferPool::Page page = writablePage(pageOf(index + done));
+                Traits::serialize(records.data() + done, n, page.data() + recordStart(slot));
+                for (size_t i = 0; i < n; i++) {
+                    setFlag(page.data(), slot + i, true);
+                    logEntry(WRITE_ENTRY, index + done + i, page.data() + recordStart(slot + i));
+                }
+                done += n;
+            }
+
+            grow(index + count, count);
         }
 
-        friend std::ostream& operator<<(std::ostream& os, const FileStorage<T>& s) {
-            std::ifstream file(s.path, std::ifstream::in | std::ifstream::binary);
-            int i;
-            file.read(reinterpret_cast<char*>(&i), sizeof(int));
-            os << "Flags: " << i << std::endl;
-            while (!file.eof()) {
-                Register<T> r(s.readln(file));
+        // zero-copy access to a record of a mapped storage, or nullptr if the
+        // record was removed. the pointer is invalidated by writes that grow the file
+        const T* view(size_t index) const {
+            static_assert(Traits::binary,
+                          "views are only available for trivially copyable types stored with BinarySerializer");
 
-                if (r.valid)
-                    os << "valid";
-                else 
-                    os << "invalid";
+            if (!mapped())
+                throw std::logic_error("views need a mapped storage");
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            checkRange(index);
 
-                os << " " << r.data << std::endl;
+            const char* page = memoryPage(pageOf(index));
+            if (!flag(page, slotOf(index)))
+                return nullptr;
+            return reinterpret_cast<const T*>(page + recordStart(slotOf(index)));
+        }
+
+        // hints the kernel about how the records are going to be accessed
+        void advise(Access access) {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            if (mapped())
+                mapping.advise(access, pageOffset(0));
+            else
+                file.advise(access, pageOffset(0));
+        }
+
+        // reads and checks every page not checked yet, throwing on the first corrupt one
+        void verify() const {
+            scan(0, size(), [] (size_t, const T&) {});
+        }
+
+        // writes the changed pages and the header back to the file
+        void flush() {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            flushPages();
+            // an unlogged mapping is clean again once its sealed pages are on disk
+            if (mapped() && !log && !fileHeader.clean) {
+                mapping.sync();
+                forgetDirtyPages();
+                fileHeader.clean = true;
+                headerDirty = true;
+            }
+            if (headerDirty)
+                writeHeader();
+            writeFreeSlots();
+        }
+
+        // flushes and waits until the data reaches the disk
+        void sync() {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            flush();
+            if (mapped()) {
+                mapping.sync();
+                forgetDirtyPages();
+            }
+            file.sync();
+        }
+
+        // makes every change done so far durable. on logged storages this only
+        // syncs the log, sharing the sync with every other thread committing at
+        // the same time, and checkpoints once the log gets too big
+        void commit() {
+            if (!log) {
+                sync();
+                return;
+            }
+
+            log->commit();
+            if (log->size() > checkpointBytes)
+                checkpoint();
+        }
+
+        // writes every logged change to the data file and empties the log
+        void checkpoint() {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            sync();
+            if (log) {
+                log->truncate();
+                std::lock_guard<std::mutex> lsnLock(lsnMutex);
+                pageLsns.clear();
+            }
+
+            fileHeader.clean = true;
+            writeHeader();
+            file.datasync();
+        }
+
+        void checkpointAfter(size_t bytes) {
+            checkpointBytes = bytes;
+        }
+
+        // where compact(maxMoves) would move each record, without moving any, so that
+        // callers can make the moves durable before they happen
+        std::map<size_t, size_t> relocations(size_t maxMoves) const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            std::map<size_t, size_t> relocations;
+            std::set<size_t> holes(freeSlots);
+            size_t size = fileHeader.size;
+
+            for (size_t moves = 0; moves < maxMoves && !holes.empty(); moves++) {
+                size_t last = size - 1;
+                if (!valid(last)) {
+                    holes.erase(last);
+                    size--;
+                    continue;
+                }
+
+                size_t hole = *holes.begin();
+                holes.erase(hole);
+                if (valid(hole))
+                    continue;
+
+                relocations[last] = hole;
+                size--;
+            }
+
+            return relocations;
+        }
+
+        // moves at most maxMoves records from the end of the file into free slots,
+        // returning where each moved record went (old index -> new index)
+        std::map<size_t, size_t> compact(size_t maxMoves) {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            std::map<size_t, size_t> relocations;
+            size_t initialSize = fileHeader.size;
+
+            for (size_t moves = 0; moves < maxMoves && !freeSlots.empty(); moves++) {
+                size_t last = fileHeader.size - 1;
+                if (!valid(last)) { // trailing holes are just dropped
+                    freeSlots.erase(last);
+                    shrink(last);
+                    continue;
+                }
+
+                size_t hole = *freeSlots.begin();
+                freeSlots.erase(hole);
+                if (valid(hole)) // overwritten after being freed
+                    continue;
+
+                write(read(last), hole);
+                relocations[last] = hole;
+                shrink(last);
+            }
+
+            freeSlotsDirty = true;
+            if (fileHeader.size < initialSize) {
+                flush();
+                if (!mapped())
+                    dropPages();
+            }
+
+            return relocations;
+        }
+
+        // compacts the whole file, returning where each moved record went
+        std::map<size_t, size_t> rewrite() {
+            return compact(std::numeric_limits<size_t>::max());
+        }
+
+        // drops every record from index size on
+        void truncate(size_t size) {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            if (size >= fileHeader.size)
+                return;
+
+            while (fileHeader.size > size)
+                shrink(fileHeader.size - 1);
+
+            freeSlotsDirty = true;
+            flush();
+            if (!mapped())
+                dropPages();
+        }
+
+        // walks the valid records in index order, reading whole blocks ahead of time
+        class const_iterator {
+            public:
+                typedef std::input_iterator_tag iterator_category;
+                typedef T value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef const T* pointer;
+                typedef const T& reference;
+
+                const_iterator() : position(0) {}
+
+                const_iterator(const FileStorage<T, Serializer>& storage, size_t from, size_t to)
+                    : scanner(std::make_shared<Scanner>(storage, from, to)), position(0) {
+                    if (!scanner->advance())
+                        scanner.reset();
+                    else
+                        settle();
+                }
+
+                // index of the current record
+                size_t index() const {
+                    return scanner->first() + position;
+                }
+
+                const T& operator*() const {
+                    return value;
+                }
+
+                const T* operator->() const {
+                    return &value;
+                }
+
+                const_iterator& operator++() {
+                    position++;
+                    settle();
+                    return *this;
+                }
+
+                const_iterator operator++(int) {
+                    const_iterator ret(*this);
+                    ++(*this);
+                    return ret;
+                }
+
+                bool operator==(const const_iterator& other) const {
+                    if (scanner != other.scanner)
+                        return false;
+                    return scanner == nullptr || position == other.position;
+                }
+
+                bool operator!=(const const_iterator& other) const {
+                    return !(*this == other);
+                }
+
+            private:
+                // copies share the scanner, as with any input iterator
+                std::shared_ptr<Scanner> scanner;
+                size_t position;
+                T value;
+
+                // moves to the first valid record from position on, or to the end
+                void settle() {
+                    while (true) {
+                        for (; position < scanner->count(); position++) {
+                            if (scanner->valid(position)) {
+                                value = Traits::deserialize(scanner->record(position));
+                                return;
+                            }
+                        }
+
+                        position = 0;
+                        if (!scanner->advance()) {
+                            scanner.reset();
+                            return;
+                        }
+                    }
+                }
+        };
+
+        const_iterator begin() const {
+            return const_iterator(*this, 0, size());
+        }
+
+        const_iterator end() const {
+            return const_iterator();
+        }
+
+        // calls visitor(index, data) on every valid record in [from, to)
+        template <typename Visitor>
+        void scan(size_t from, size_t to, Visitor visitor) const {
+            Scanner scanner(*this, from, std::min(to, size()));
+            while (scanner.advance()) {
+                for (size_t i = 0; i < scanner.count(); i++) {
+                    if (scanner.valid(i))
+                        visitor(scanner.first() + i, Traits::deserialize(scanner.record(i)));
+                }
+            }
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const FileStorage<T, Serializer>& s) {
+            std::lock_guard<std::recursive_mutex> lock(s.mutex);
+            os << s.fileHeader << std::endl;
+            for (size_t i = 0; i < s.fileHeader.size; i++) {
+                if (s.valid(i))
+                    os << "valid " << s.read(i) << std::endl;
+                else
+                    os << "invalid" << std::endl;
             }
 
             return os;
         }
 
     private:
-        std::string path;
+        // reads the pages holding [from, to) a block at a time, keeping the read
+        // of the following block in flight while the current one is being visited
+        class Scanner {
+            public:
+                Scanner(const FileStorage<T, Serializer>& storage, size_t from, size_t to)
+                    : storage(storage), from(from), to(std::max(from, to)), currentPage(0), currentPages(0) {
+                    nextPage = pageOf(from);
+                    endPage = from < to ? pageOf(to - 1) + 1 : nextPage;
+                    if (from < to)
+                        storage.adviseRange(Access::SEQUENTIAL, nextPage, endPage);
+                    prefetch();
+                }
+
+                virtual ~Scanner() {
+                    if (pending.valid()) // the read in flight still uses ahead
+                        pending.wait();
+                }
+
+                Scanner(const Scanner& other) = delete;
+                Scanner& operator=(const Scanner& other) = delete;
 
-        void writeHeader(std::ofstream& file, const FileHeader& header) {
-            std::streampos startPos = file.tellp();
-            file.seekp(0, file.beg);
-            file.write(header, sizeof(FileHeader));
-            file.seekp(startPos, file.beg);
+                // moves to the next block, returning false past the last one
+                bool advance() {
+                    if (!pending.valid())
+                        return false;
+
+                    pending.get();
+                    current.swap(ahead);
+                    currentPage = aheadPage;
+                    currentPages = aheadPages;
+                    prefetch();
+                    return true;
+                }
+
+                // index of the first record of the block in [from, to)
+                size_t first() const {
+                    return std::max(from, currentPage * recordsPerPage());
+                }
+
+                size_t count() const {
+                    return std::min(to, (currentPage + currentPages) * recordsPerPage()) - first();
+                }
+
+                bool valid(size_t i) const {
+                    size_t offset = first() + i - currentPage * recordsPerPage();
+                    return flag(current.data() + offset / recordsPerPage() * pageSize(), offset % recordsPerPage());
+                }
+
+                const char* record(size_t i) const {
+                    size_t offset = first() + i - currentPage * recordsPerPage();
+                    return current.data() + offset / recordsPerPage() * pageSize() + recordStart(offset % recordsPerPage());
+                }
+
+            private:
+                const FileStorage<T, Serializer>& storage;
+                size_t from;
+                size_t to;
+                size_t nextPage;
+                size_t endPage;
+
+                std::vector<char> current;
+                size_t currentPage;
+                size_t currentPages;
+
+                std::vector<char> ahead;
+                size_t aheadPage;
+                size_t aheadPages;
+                std::future<void> pending;
+
+                void prefetch() {
+                    if (nextPage >= endPage)
+                        return;
+
+                    aheadPage = nextPage;
+                    aheadPages = std::min(std::max<size_t>(SCAN_BLOCK_BYTES / pageSize(), 1), endPage - nextPage);
+                    nextPage += aheadPages;
+                    ahead.resize(aheadPages * pageSize());
+                    pending = AsyncIO::shared().pool().submit([this] {
+                        storage.readBlock(aheadPage, aheadPages, ahead.data());
+                    });
+                }
+        };
+
+        enum LogEntryType : uint8_t { WRITE_ENTRY, REMOVE_ENTRY, RESIZE_ENTRY };
+
+        struct PageHeader {
+            uint32_t checksum; // of the rest of the page
+            uint32_t page;     // so that pages written to the wrong place are caught too
+        };
+
+        File file;
+        Mapping mapping;
+        FileHeader fileHeader;
+
+        // guards everything below, so that many threads can write and commit at once
+        mutable std::recursive_mutex mutex;
+
+        std::unique_ptr<WriteAheadLog> log;
+        size_t checkpointBytes;
+
+        // the last log sequence number of each changed page, taken by evictions from any thread
+        std::map<size_t, uint64_t> pageLsns;
+        mutable std::mutex lsnMutex;
+
+        // free slots are kept sorted so that reuse and compaction fill the lowest holes first
+        std::set<size_t> freeSlots;
+        bool freeSlotsDirty;
+
+        // pages checked since the file was opened
+        mutable std::vector<bool> verified;
+
+        // caches the pages, when not mapped
+        BufferPool& pool;
+
+        // pages of the mapping whose checksum is out of date
+        std::set<size_t> dirtyPages;
+
+        // pages of the mapping changed since it was last synced, also listed in dirtyList
+        std::set<size_t> listedPages;
+        File dirtyList;
+
+        bool headerDirty;
+        bool recovering; // replaying the log, whose pages may be torn until they are rewritten
+
+        // record data is aligned to T inside a page, so that views into a mapping are aligned too
+        static constexpr size_t dataAlignment() {
+            return Traits::binary ? alignof(T) : 1;
+        }
+
+        static constexpr size_t dataStart(size_t records) {
+            size_t flags = sizeof(PageHeader) + (records + 7) / 8;
+            return (flags + dataAlignment() - 1) / dataAlignment() * dataAlignment();
+        }
+
+        static constexpr size_t recordsFitting(size_t pageBytes) {
+            size_t records = (pageBytes - sizeof(PageHeader)) / Serializer::size;
+            while (records > 0 && dataStart(records) + records * Serializer::size > pageBytes)
+                records--;
+            return records;
+        }
+
+        // the smallest whole number of PAGE_SIZE blocks holding at least a record
+        static constexpr size_t pageSize() {
+            size_t bytes = PAGE_SIZE;
+            while (recordsFitting(bytes) == 0)
+                bytes += PAGE_SIZE;
+            return bytes;
+        }
+
+        static constexpr size_t recordsPerPage() {
+            return recordsFitting(pageSize());
+        }
+
+        static constexpr size_t pageOf(size_t index) {
+            return index / recordsPerPage();
+        }
+
+        static constexpr size_t slotOf(size_t index) {
+            return index % recordsPerPage();
+        }
+
+        static constexpr size_t pageCount(size_t records) {
+            return (records + recordsPerPage() - 1) / recordsPerPage();
+        }
+
+        // the header takes the first page of the file
+        static constexpr size_t pageOffset(size_t page) {
+            return (page + 1) * pageSize();
+        }
+
+        static constexpr size_t flagOffset(size_t slot) {
+            return sizeof(PageHeader) + slot / 8;
+        }
+
+        static constexpr uint8_t flagMask(size_t slot) {
+            return 1 << (slot % 8);
+        }
+
+        static constexpr size_t recordStart(size_t slot) {
+            return dataStart(recordsPerPage()) + slot * Serializer::size;
+        }
+
+        static bool flag(const char* page, size_t slot) {
+            return static_cast<uint8_t>(page[flagOffset(slot)]) & flagMask(slot);
+        }
+
+        static void setFlag(char* page, size_t slot, bool value) {
+            uint8_t flags = page[flagOffset(slot)];
+            page[flagOffset(slot)] = value ? flags | flagMask(slot) : flags & ~flagMask(slot);
+        }
+
+        static uint32_t pageChecksum(const char* page) {
+            return CRC32C::compute(page + sizeof(uint32_t), pageSize() - sizeof(uint32_t));
+        }
+
+        static bool intact(size_t page, const char* data) {
+            PageHeader header;
+            std::memcpy(&header, data, sizeof(PageHeader));
+            if (header.page == static_cast<uint32_t>(page) && header.checksum == pageChecksum(data))
+                return true;
+            return std::all_of(data, data + pageSize(), [] (char c) { return c == 0; });
+        }
+
+        // stamps a page with its number and checksum before it goes to the file
+        static void seal(size_t page, char* data) {
+            PageHeader header;
+            header.page = static_cast<uint32_t>(page);
+            std::memcpy(data + offsetof(PageHeader, page), &header.page, sizeof(uint32_t));
+            header.checksum = pageChecksum(data);
+            std::memcpy(data, &header.checksum, sizeof(uint32_t));
+        }
+
+        static size_t mappedLength(size_t records) {
+            size_t bytes = pageOffset(pageCount(records));
+            return (bytes / MAP_CHUNK + 1) * MAP_CHUNK;
+        }
+
+        [[noreturn]] void corrupt(size_t page) const {
+            throw std::runtime_error("corrupt page " + std::to_string(page) + " in " + file.name());
+        }
+
+        bool isVerified(size_t page) const {
+            return page < verified.size() && verified[page];
+        }
+
+        void markVerified(size_t page) const {
+            if (page >= verified.size())
+                verified.resize(page + 1, false);
+            verified[page] = true;
+        }
+
+        // checks a page a scan read from the file on its first access. a mismatch can
+        // come from a write back racing with the read, so the page is taken again from
+        // the pool, which reads it under the latch the write back holds
+        void checkPage(size_t page, char* data) const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            if (isVerified(page))
+                return;
+
+            if (intact(page, data) || !pool.read(*this, page, data))
+                markVerified(page);
+        }
+
+        // a page of the mapping, checked on its first access
+        const char* memoryPage(size_t page) const {
+            const char* data = mapping.get() + pageOffset(page);
+            if (!isVerified(page)) {
+                if (!intact(page, data))
+                    corrupt(page);
+                markVerified(page);
+            }
+            return data;
+        }
+
+        // the pool takes pins from const members too: writing pages back is not a change
+        BufferPool::Client& client() const {
+            return const_cast<FileStorage&>(*this);
+        }
+
+        BufferPool::Page pinPage(size_t page) const {
+            return pool.pin(client(), page);
         }
 
-        FileHeader header(std::ifstream& file) const {
-            std::streampos startPos = file.tellg();
-            file.seekg(0, file.beg);
-            FileHeader header;
-            file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
-            file.seekg(startPos, file.beg);
-            return header;
+        // a page about to be changed, pinned. pages are checked when they are read, so
+        // that corruption is never sealed in
+        BufferPool::Page writablePage(size_t page) {
+            if (mapped()) {
+                if (pageOffset(page + 1) > mapping.size())
+                    mapping.map(file, mappedLength((page + 1) * recordsPerPage()));
+                if (listedPages.count(page) == 0)
+                    listDirtyPages(page);
+                char* data = const_cast<char*>(memoryPage(page));
+                dirtyPages.insert(page);
+                return BufferPool::Page(data, page);
+            }
+            return pool.pin(*this, page, true);
+        }
+
+        // the kernel may write a mapped page back before it is sealed, so the file is
+        // marked not clean, and the page listed, on disk before its first change since a sync.
+        // pages past the last record hold nothing yet, so appends list the rest of the mapping at once
+        void listDirtyPages(size_t page) {
+            if (fileHeader.clean) {
+                fileHeader.clean = false;
+                writeHeader();
+                file.datasync();
+            }
+
+            size_t listed = listedPages.size();
+            std::vector<uint32_t> pages(1, static_cast<uint32_t>(page));
+            listedPages.insert(page);
+            if (page >= pageCount(fileHeader.size)) {
+                for (size_t next = page + 1; pageOffset(next + 1) <= mapping.size(); next++) {
+                    if (listedPages.insert(next).second)
+                        pages.push_back(static_cast<uint32_t>(next));
+                }
+            }
+
+            dirtyList.write(listed * sizeof(uint32_t), reinterpret_cast<const char*>(pages.data()), pages.size() * sizeof(uint32_t));
+            dirtyList.datasync();
+        }
+
+        // called once the mapping is synced after a flush, which put the listed pages on disk sealed
+        void forgetDirtyPages() {
+            if (listedPages.empty())
+                return;
+
+            dirtyList.truncate(0);
+            listedPages.clear();
         }
 
-        Register<T> readln(std::ifstream& file, size_t line) const {
-            setInPosition(file, line);
-            readln(file);
+        size_t pageBytes() const override {
+            return pageSize();
+        }
+
+        void load(size_t page, char* data) const override {
+            size_t n = file.read(pageOffset(page), data, pageSize());
+            std::fill(data + n, data + pageSize(), 0); // pages past the end of the file were never written
+            if (!recovering && !intact(page, data)) // pages torn by a crash are rebuilt from the log
+                corrupt(page);
+        }
+
+        // replay only redoes changes, so a page of a logged storage may only reach the
+        // file once the log holds every change made to it. pages replayed from the log
+        // have no sequence number, as the log may not be entered while it replays
+        void store(size_t page, char* data) override {
+            uint64_t lsn = pageLsn(page);
+            if (lsn > 0)
+                log->commit(lsn);
+            seal(page, data);
+            file.write(pageOffset(page), data, pageSize());
+        }
+
+        // drops the pages past the last record, from the pool and from the file
+        void dropPages() {
+            pool.discard(*this, pageCount(fileHeader.size));
+            file.truncate(pageOffset(pageCount(fileHeader.size)));
+        }
+
+        // copies count pages starting at first into out, checking them. pages changed
+        // in the pool are taken from it, so scans see every earlier write
+        void readBlock(size_t first, size_t count, char* out) const {
+            std::unique_lock<std::recursive_mutex> lock(mutex);
+            if (mapped()) {
+                size_t available = std::min(first + count, pageCount(fileHeader.size));
+                for (size_t page = first; page < available; page++)
+                    std::copy_n(memoryPage(page), pageSize(), out + (page - first) * pageSize());
+                std::fill(out + (std::max(first, available) - first) * pageSize(), out + count * pageSize(), 0);
+                return;
+            }
+
+            std::map<size_t, std::vector<char>> overlay = pool.dirtyCopies(*this, first, count);
+            lock.unlock();
+
+            // pages past the end of the file, dropped by a concurrent compaction, read as empty
+            size_t n = file.read(pageOffset(first), out, count * pageSize());
+            std::fill(out + n, out + count * pageSize(), 0);
+            for (size_t page = first; page < first + count; page++) {
+                char* data = out + (page - first) * pageSize();
+                auto cached = overlay.find(page);
+                if (cached == overlay.end())
+                    checkPage(page, data);
+                else
+                    std::copy(cached->second.begin(), cached->second.end(), data);
+            }
+        }
+
+        void adviseRange(Access access, size_t firstPage, size_t lastPage) const {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            if (mapped())
+                mapping.advise(access, pageOffset(firstPage), pageOffset(lastPage) - pageOffset(firstPage));
+            else
+                file.advise(access, pageOffset(firstPage), pageOffset(lastPage) - pageOffset(firstPage));
+        }
+
+        // seals the changed pages, writing runs of adjacent ones with single requests.
+        // pages stay changed in the pool until written, so that scans keep seeing them
+        void flushPages() {
+            for (size_t page : dirtyPages)
+                seal(page, mapping.get() + pageOffset(page));
+            dirtyPages.clear();
+
+            std::vector<size_t> pages = pool.dirtyPages(*this);
+            if (pages.empty())
+                return;
+            if (log) // the pages may only reach the file after their changes reach the log
+                log->commit();
+
+            std::vector<std::vector<char>> runs;
+            std::vector<IORequest> requests;
+            size_t runPages = std::max<size_t>(BATCH_RECORDS / recordsPerPage(), 1);
+            for (size_t i = 0; i < pages.size(); ) {
+                size_t first = pages[i], count = 0;
+                runs.emplace_back();
+                while (i < pages.size() && pages[i] == first + count && count < runPages) {
+                    runs.back().resize((count + 1) * pageSize());
+                    char* data = runs.back().data() + count * pageSize();
+                    pool.read(*this, pages[i], data); // evicted meanwhile, it was written back
+                    seal(pages[i], data);
+                    i++;
+                    count++;
+                }
+                requests.emplace_back(runs.back().data(), pageOffset(first), runs.back().size(), true);
+            }
+
+            AsyncIO::shared().run(file, requests);
+            for (size_t page : pages)
+                pool.clean(*this, page);
+        }
+
+        std::string freeSlotsPath() const {
+            return file.name() + ".free";
+        }
+
+        void loadFreeSlots() {
+            freeSlotsDirty = false;
+            if (::access(freeSlotsPath().c_str(), F_OK) != 0)
+                return;
+
+            File freeFile(freeSlotsPath());
+            size_t count = 0;
+            freeFile.read(0, reinterpret_cast<char*>(&count), sizeof(size_t));
+
+            std::vector<size_t> slots(count);
+            freeFile.read(sizeof(size_t), reinterpret_cast<char*>(slots.data()), count * sizeof(size_t));
+            for (size_t slot : slots) {
+                if (slot < fileHeader.size)
+                    freeSlots.insert(slot);
+            }
+        }
+
+        void writeFreeSlots() {
+            if (!freeSlotsDirty)
+                return;
+
+            std::vector<size_t> slots;
+            slots.reserve(freeSlots.size() + 1);
+            slots.push_back(freeSlots.size());
+            slots.insert(slots.end(), freeSlots.begin(), freeSlots.end());
+
+            File freeFile(freeSlotsPath());
+            freeFile.write(0, reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(size_t));
+            freeFile.truncate(slots.size() * sizeof(size_t));
+            freeSlotsDirty = false;
+        }
+
+        size_t takeFreeSlot() {
+            while (!freeSlots.empty()) {
+                size_t slot = *freeSlots.begin();
+                freeSlots.erase(freeSlots.begin());
+                freeSlotsDirty = true;
+                if (!valid(slot)) // slots written to directly after being freed are skipped
+                    return slot;
+            }
+            return fileHeader.size;
+        }
+
+        // extends the storage to hold size records, the last written of which were just written
+        // records [size - written, size) were just written, so none of them is free any more
+        void grow(size_t size, size_t written = 1) {
+            auto first = freeSlots.lower_bound(size - written);
+            auto last = freeSlots.lower_bound(size);
+            if (first != last) {
+                freeSlots.erase(first, last);
+                freeSlotsDirty = true;
+            }
+
+            if (size <= fileHeader.size)
+                return;
+
+            // skipped records are invalid, so they can be reused
+            for (size_t i = fileHeader.size; i + written < size; i++) {
+                freeSlots.insert(i);
+                freeSlotsDirty = true;
+            }
+
+            fileHeader.size = size;
+            headerDirty = true;
+        }
+
+        // drops the last record, which must be the one at index
+        void shrink(size_t index) {
+            if (valid(index))
+                remove(index);
+            freeSlots.erase(index);
+            fileHeader.size = index;
+            headerDirty = true;
+            logEntry(RESIZE_ENTRY, index);
+        }
+
+        void logEntry(LogEntryType type, uint64_t index, const char* record = nullptr) {
+            if (!log || recovering)
+                return;
+
+            // the header is marked dirty (and synced) before the first change
+            // after a checkpoint, so that the next open knows it has to replay
+            if (fileHeader.clean) {
+                fileHeader.clean = false;
+                writeHeader();
+                file.datasync();
+            }
+
+            char entry[sizeof(uint64_t) + sizeof(uint8_t)];
+            std::memcpy(entry, &index, sizeof(uint64_t));
+            entry[sizeof(uint64_t)] = type;
+
+            uint64_t lsn;
+            if (record == nullptr)
+                lsn = log->append(entry, sizeof(entry));
+            else {
+                std::vector<char> image(entry, entry + sizeof(entry));
+                image.insert(image.end(), record, record + Serializer::size);
+                lsn = log->append(image.data(), image.size());
+            }
+
+            if (type != RESIZE_ENTRY) {
+                std::lock_guard<std::mutex> lock(lsnMutex);
+                pageLsns[pageOf(index)] = lsn;
+            }
+        }
+
+        // the log sequence number of the last change to a page, 0 if it was not changed
+        uint64_t pageLsn(size_t page) const {
+            std::lock_guard<std::mutex> lock(lsnMutex);
+            auto it = pageLsns.find(page);
+            return it == pageLsns.end() ? 0 : it->second;
+        }
+
+        // redoes every logged change through the pool, before the file is mapped
+        void replay() {
+            const size_t header = sizeof(uint64_t) + sizeof(uint8_t);
+            log->replay([this, header] (const char* entry, size_t n) {
+                if (n < header || n != header + (entry[sizeof(uint64_t)] == WRITE_ENTRY ? Serializer::size : 0))
+                    return;
+
+                uint64_t index;
+                std::memcpy(&index, entry, sizeof(uint64_t));
+                uint8_t type = entry[sizeof(uint64_t)];
+                const char* record = entry + sizeof(uint64_t) + sizeof(uint8_t);
+
+                if (type == WRITE_ENTRY) {
+                    BufferPool::Page page = writablePage(pageOf(index));
+                    setFlag(page.data(), slotOf(index), true);
+                    std::copy(record, record + Serializer::size, page.data() + recordStart(slotOf(index)));
+                    fileHeader.size = std::max<size_t>(fileHeader.size, index + 1);
+                }
+                else if (type == REMOVE_ENTRY)
+                    setFlag(writablePage(pageOf(index)).data(), slotOf(index), false);
+                else if (type == RESIZE_ENTRY)
+                    fileHeader.size = index;
+            });
+            flushPages();
+            dropPages();
+            headerDirty = true;
+        }
+
+        // pages changed in a mapping are only sealed when flushed, so after a crash the
+        // listed ones that do not match their checksum are sealed again with what they
+        // hold, and logged changes are replayed on top of them. every other page is still
+        // checked as usual, and the pages past the last record are dropped
+        void reseal() {
+            std::string listPath = file.name() + ".dirty";
+            if (::access(listPath.c_str(), F_OK) == 0) {
+                File list(listPath);
+                std::vector<uint32_t> pages(list.size() / sizeof(uint32_t));
+                list.read(0, reinterpret_cast<char*>(pages.data()), pages.size() * sizeof(uint32_t));
+
+                std::vector<char> data(pageSize());
+                for (uint32_t page : pages) {
+                    size_t n = file.read(pageOffset(page), data.data(), pageSize());
+                    std::fill(data.begin() + n, data.end(), 0);
+                    if (intact(page, data.data()))
+                        continue;
+                    seal(page, data.data());
+                    file.write(pageOffset(page), data.data(), pageSize());
+                }
+            }
+
+            file.truncate(pageOffset(pageCount(fileHeader.size)));
+            file.datasync();
+            if (::access(listPath.c_str(), F_OK) == 0)
+                File(listPath).truncate(0);
+        }
+
+        // the free list is not logged, so after a crash it is rebuilt from the valid flags
+        void rebuildFreeSlots() {
+            freeSlots.clear();
+            for (size_t i = 0; i < fileHeader.size; i++) {
+                if (!valid(i))
+                    freeSlots.insert(i);
+            }
+            freeSlotsDirty = true;
         }
 
-        Register<T> readln(std::ifstream& file) const {
-            Register<T> r;
-            file.read(r.c_ptr(), sizeof(Register<T>));
-            return r;
+        void checkRange(size_t index) const {
+            if (index >= fileHeader.size)
+                throw std::out_of_range("record index out of range");
         }
 
-        void setOutPosition(std::ofstream& file, size_t offset) {
-            file.seekp(sizeof(FileHeader) + offset * sizeof(Register<T>), file.beg);
+        void readHeader() {
+            if (file.read(0, reinterpret_cast<char*>(&fileHeader), sizeof(FileHeader)) < sizeof(FileHeader) ||
+                fileHeader.magic != MAGIC)
+                throw std::runtime_error(file.name() + " is not a storage file");
+            if (fileHeader.version != VERSION)
+                throw std::runtime_error(file.name() + " has unsupported format version " + std::to_string(fileHeader.version));
+            if (fileHeader.checksum != fileHeader.compute())
+                throw std::runtime_error("corrupt header in " + file.name());
+            if (fileHeader.pageSize != pageSize() || fileHeader.recordSize != Serializer::size)
+                throw std::runtime_error(file.name() + " holds records of another type");
         }
 
-        void setInPosition(std::ifstream& file, size_t offset) const {
-            file.seekg(sizeof(FileHeader) + offset * sizeof(Register<T>), file.beg);
+        void writeHeader() {
+            // mappings share the page cache with the descriptor, so this is seen through them too
+            fileHeader.checksum = fileHeader.compute();
+            file.write(0, fileHeader, sizeof(FileHeader));
+            headerDirty = false;
         }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,718 @@
+#ifndef LSMSTORE_INCLUDED
+#define LSMSTORE_INCLUDED
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include "AVLKVStore.hpp"
+#include "AsyncIO.hpp"
+#include "BloomFilter.hpp"
+#include "Checksum.hpp"
+#include "FileIO.hpp"
+#include "FileStorage.hpp"
+#include "Serializers.hpp"
+#include "WriteAheadLog.hpp"
+#include "XorFilter.hpp"
+
+/* A log structured merge store. writes go to an AVLKVStore memtable and to its
+   write ahead log (made durable by commit()). a memtable holding MEMTABLE_RECORDS
+   keys is sealed and written out in the background as an immutable sorted run,
+   while writes go on into a new one. runs are merged by leveled compaction: level
+   0 holds up to L0_RUNS overlapping runs, and level i > 0 a single run of at most
+   MEMTABLE_RECORDS * LEVEL_RATIO^i entries
+
+   FILES
+   path + ".manifest"       the runs of every level, replaced as a whole
+   path + ".<id>.run"       FileStorage of (key, value, removed) entries sorted by key
+   path + ".<id>.run.meta"  the first key of every page (fence pointers), the last
+                            key and a filter of the keys of the run
+   path + ".<id>.wal"       log of memtable id, deleted once the memtable is in a run
+
+   MANIFEST FORMAT
+   (ManifestHeader) header
+   (uint64_t)[] for every level, its run count followed by its run ids, newest first
+
+   a lookup goes through the memtables and then every run from the newest, skipping
+   those whose key range or filter rule the key out, so that it costs at most one
+   page read per run, and a missing key a read only on false positives. Filter is
+   either filter of BloomFilter.hpp, built at the false positive rate the store is
+   opened with: runs never change, so XorFilter takes less memory for the same rate */
+template <typename K,
+          typename V,
+          class Less = std::less<K>,
+          class KeySerializer = BinarySerializer<K>,
+          class ValueSerializer = BinarySerializer<V>,
+          class Hash = std::hash<K>,
+          class Filter = BloomFilter>
+class LSMStore {
+    private:
+        struct Entry {
+            K key;
+            V value;
+            bool removed;
+        };
+
+        struct EntrySerializer {
+            static constexpr size_t size = KeySerializer::size + ValueSerializer::size + 1;
+
+            static void serialize(const Entry& in, char* out) {
+                KeySerializer::serialize(in.key, out);
+                ValueSerializer::serialize(in.value, out + KeySerializer::size);
+                out[size - 1] = in.removed;
+            }
+
+            static void deserialize(const char* in, Entry& out) {
+                KeySerializer::deserialize(in, out.key);
+                ValueSerializer::deserialize(in + KeySerializer::size, out.value);
+                out.removed = in[size - 1] != 0;
+            }
+        };
+
+        typedef FileStorage<Entry, EntrySerializer> RunFile;
+        typedef AVLKVStore<K, std::pair<V, bool>, Less> Memtable; // (value, removed)
+
+    public:
+        static constexpr uint32_t MAGIC = 0x4D535641;
+        static constexpr uint32_t META_MAGIC = 0x52535641;
+        static constexpr uint16_t VERSION = 2;
+
+        static constexpr size_t MEMTABLE_RECORDS = 1 << 16;
+        static constexpr size_t L0_RUNS = 4;
+        static constexpr size_t LEVEL_RATIO = 10;
+        static constexpr double FALSE_POSITIVE_RATE = 0.01;
+
+        typedef struct ManifestHeader {
+            ManifestHeader()
+                : magic(MAGIC), version(VERSION), reserved(0), levels(0),
+                  nextRun(0), flushed(0), ids(0), padding(0), checksum(0) {}
+
+            uint32_t magic;
+            uint16_t version;
+            uint16_t reserved;
+            uint64_t levels;
+            uint64_t nextRun;  // id of the next run written
+            uint64_t flushed;  // memtables up to this id are in runs
+            uint64_t ids;      // uint64_t following the header
+            uint32_t padding;
+            uint32_t checksum; // of every field above and of the ids
+
+            uint32_t compute(const std::vector<uint64_t>& body) const {
+                uint32_t crc = CRC32C::compute(reinterpret_cast<const char*>(body.data()), body.size() * sizeof(uint64_t));
+                return CRC32C::compute(reinterpret_cast<const char*>(this), offsetof(ManifestHeader, checksum), crc);
+            }
+
+            operator const char*() const {
+                return reinterpret_cast<const char*>(this);
+            }
+
+            operator char*() {
+                return reinterpret_cast<char*>(this);
+            }
+        } ManifestHeader;
+
+    private:
+        static uint64_t hash(const K& key) {
+            return mixHash(Hash()(key));
+        }
+
+        // an immutable sorted file of entries, deleted once retired and no longer read
+        class Run {
+            private:
+                struct MetaHeader {
+                    uint32_t magic;
+                    uint16_t version;
+                    uint16_t filterKind;
+                    uint64_t entries;
+                    uint64_t fences;
+                    uint64_t filterBytes;
+                    uint32_t padding;
+                    uint32_t checksum; // of every field above and of what follows
+                };
+
+                std::string path;
+                std::unique_ptr<RunFile> file;
+                std::vector<K> fences; // first key of every page
+                K last;
+                Filter filter;
+                std::atomic<bool> retired;
+
+                static std::string metaPath(const std::string& path) {
+                    return path + ".meta";
+                }
+
+                static uint32_t checksum(const MetaHeader& header, const std::vector<char>& body) {
+                    uint32_t crc = CRC32C::compute(body.data(), body.size());
+                    return CRC32C::compute(reinterpret_cast<const char*>(&header), offsetof(MetaHeader, checksum), crc);
+                }
+
+                static void writeMeta(const std::string& path, size_t entries, const std::vector<K>& fences,
+                                      const K& last, const Filter& filter) {
+                    std::vector<char> body((fences.size() + 1) * KeySerializer::size);
+                    char* out = body.data();
+                    for (const K& fence : fences) {
+                        KeySerializer::serialize(fence, out);
+                        out += KeySerializer::size;
+                    }
+                    KeySerializer::serialize(last, out);
+                    filter.encode(body);
+
+                    MetaHeader header = {META_MAGIC, VERSION, Filter::KIND, entries, fences.size(),
+                                         body.size() - (fences.size() + 1) * KeySerializer::size, 0, 0};
+                    header.checksum = checksum(header, body);
+
+                    File meta(metaPath(path), O_RDWR | O_CREAT | O_TRUNC);
+                    meta.write(0, reinterpret_cast<const char*>(&header), sizeof(MetaHeader));
+                    meta.write(sizeof(MetaHeader), body.data(), body.size());
+                    meta.sync();
+                }
+
+                void readMeta() {
+                    File meta(metaPath(path), O_RDWR);
+                    MetaHeader header;
+                    if (meta.read(0, reinterpret_cast<char*>(&header), sizeof(MetaHeader)) < sizeof(MetaHeader) ||
+                        header.magic != META_MAGIC || header.version != VERSION)
+                        throw std::runtime_error(metaPath(path) + " is not a run index");
+                    if (header.filterKind != Filter::KIND)
+                        throw std::runtime_error(metaPath(path) + " was written with another filter");
+
+                    std::vector<char> body((header.fences + 1) * KeySerializer::size + header.filterBytes);
+                    if (meta.read(sizeof(MetaHeader), body.data(), body.size()) < body.size() ||
+                        checksum(header, body) != header.checksum)
+                        throw std::runtime_error("corrupt run index " + metaPath(path));
+                    if (header.entries != file->size())
+                        throw std::runtime_error(path + " does not match its index");
+
+                    const char* in = body.data();
+                    fences.resize(header.fences);
+                    for (K& fence : fences) {
+                        KeySerializer::deserialize(in, fence);
+                        in += KeySerializer::size;
+                    }
+                    KeySerializer::deserialize(in, last);
+                    in += KeySerializer::size;
+
+                    Filter::decode(in, body.data() + body.size(), filter);
+                }
+
+            public:
+                const uint64_t id;
+
+                Run(const std::string& path, uint64_t id)
+                    : path(path), file(new RunFile(path)), retired(false), id(id) {
+                    readMeta();
+                }
+
+                virtual ~Run() {
+                    file.reset();
+                    if (retired) {
+                        std::remove(path.c_str());
+                        std::remove(metaPath(path).c_str());
+                    }
+                }
+
+                Run(const Run& other) = delete;
+                Run& operator=(const Run& other) = delete;
+
+                // writes the entries next(entry) yields, in key order, until it returns
+                // false. returns how many there were
+                template <class Source>
+                static size_t write(const std::string& path, size_t maxEntries, double falsePositiveRate, Source next) {
+                    const size_t B = RunFile::blockRecords();
+                    std::vector<K> fences;
+                    std::vector<uint64_t> hashes;
+                    hashes.reserve(maxEntries);
+                    K last = K();
+                    size_t count = 0;
+
+                    std::remove(path.c_str()); // left by a write that crashed
+                    {
+                        RunFile file(path);
+                        std::vector<Entry> block;
+                        block.reserve(B);
+                        Entry entry;
+                        while (next(entry)) {
+                            if (block.empty())
+                                fences.push_back(entry.key);
+                            hashes.push_back(hash(entry.key));
+                            last = entry.key;
+                            block.push_back(entry);
+                            if (block.size() == B) {
+                                file.writeBatch(count, block.begin(), block.end());
+                                count += block.size();
+                                block.clear();
+                            }
+                        }
+                        file.writeBatch(count, block.begin(), block.end());
+                        count += block.size();
+                        file.flush();
+                        file.sync();
+                    }
+
+                    writeMeta(path, count, fences, last, Filter(hashes, falsePositiveRate));
+                    return count;
+                }
+
+                size_t size() const {
+                    return file->size();
+                }
+
+                size_t filterBytes() const {
+                    return filter.bytes();
+                }
+
+                // the entry of key, reading the single page its fences point to
+                bool find(const K& key, Entry& out) const {
+                    Less less;
+                    if (fences.empty() || less(key, fences.front()) || less(last, key) || !filter.mayContain(hash(key)))
+                        return false;
+
+                    const size_t B = RunFile::blockRecords();
+                    size_t block = std::upper_bound(fences.begin(), fences.end(), key, less) - fences.begin() - 1;
+                    std::vector<size_t> indices(std::min(B, file->size() - block * B));
+                    for (size_t i = 0; i < indices.size(); i++)
+                        indices[i] = block * B + i;
+
+                    std::vector<Entry> entries = file->readBatch(indices);
+                    auto it = std::lower_bound(entries.begin(), entries.end(), key,
+                                               [&less] (const Entry& e, const K& k) { return less(e.key, k); });
+                    if (it == entries.end() || less(key, it->key))
+                        return false;
+                    out = *it;
+                    return true;
+                }
+
+                typename RunFile::const_iterator begin() const {
+                    return file->begin();
+                }
+
+                typename RunFile::const_iterator end() const {
+                    return file->end();
+                }
+
+                // deletes the files once the last reader lets go of the run
+                void retire() {
+                    retired = true;
+                }
+        };
+
+        std::string path;
+        double falsePositiveRate;
+
+        // writer serializes the writers, mutex guards what readers and the background
+        // task share with them
+        std::mutex writer;
+        mutable std::mutex mutex;
+
+        std::shared_ptr<Memtable> memtable;
+        std::shared_ptr<Memtable> immutable; // sealed, being written out
+        size_t memtableRecords;
+        uint64_t memtableId, immutableId;
+        std::unique_ptr<WriteAheadLog> log;
+
+        std::vector<std::vector<std::shared_ptr<Run>>> levels; // level 0 newest first
+        uint64_t nextRun;
+        uint64_t flushed;
+        std::future<void> background;
+
+        std::string runPath(uint64_t id) const {
+            return path + "." + std::to_string(id) + ".run";
+        }
+
+        std::string logPath(uint64_t id) const {
+            return path + "." + std::to_string(id) + ".wal";
+        }
+
+        std::string manifestPath() const {
+            return path + ".manifest";
+        }
+
+        void readManifest() {
+            if (::access(manifestPath().c_str(), F_OK) != 0)
+                return;
+
+            File file(manifestPath(), O_RDWR);
+            ManifestHeader header;
+            if (file.read(0, header, sizeof(ManifestHeader)) < sizeof(ManifestHeader) || header.magic != MAGIC)
+                throw std::runtime_error(manifestPath() + " is not a manifest");
+            if (header.version != VERSION)
+                throw std::runtime_error(manifestPath() + " has unsupported format version " + std::to_string(header.version));
+
+            std::vector<uint64_t> body(header.ids);
+            if (file.read(sizeof(ManifestHeader), reinterpret_cast<char*>(body.data()), body.size() * sizeof(uint64_t)) <
+                body.size() * sizeof(uint64_t) || header.checksum != header.compute(body))
+                throw std::runtime_error("corrupt manifest " + manifestPath());
+
+            size_t i = 0;
+            levels.resize(header.levels);
+            for (auto& level : levels) {
+                size_t runs = body.at(i++);
+                for (size_t r = 0; r < runs; r++) {
+                    uint64_t id = body.at(i++);
+                    level.push_back(std::make_shared<Run>(runPath(id), id));
+                }
+            }
+            nextRun = header.nextRun;
+            flushed = header.flushed;
+        }
+
+        // writes the manifest next to the old one, then swaps them
+        void writeManifest() const {
+            std::vector<uint64_t> body;
+            for (const auto& level : levels) {
+                body.push_back(level.size());
+                for (const auto& run : level)
+                    body.push_back(run->id);
+            }
+
+            ManifestHeader header;
+            header.levels = levels.size();
+            header.nextRun = nextRun;
+            header.flushed = flushed;
+            header.ids = body.size();
+            header.checksum = header.compute(body);
+
+            const std::string tmpPath = manifestPath() + ".tmp";
+            {
+                File file(tmpPath, O_RDWR | O_CREAT | O_TRUNC);
+                file.write(0, header, sizeof(ManifestHeader));
+                file.write(sizeof(ManifestHeader), reinterpret_cast<const char*>(body.data()), body.size() * sizeof(uint64_t));
+                file.sync();
+            }
+            if (std::rename(tmpPath.c_str(), manifestPath().c_str()) != 0)
+                throw std::runtime_error("could not replace " + manifestPath() + ": " + std::strerror(errno));
+        }
+
+        // replays the logs of the memtables which were not written out before the
+        // last close, and writes them out as one run
+        void recover() {
+            memtableId = flushed + 1;
+            uint64_t first = memtableId;
+            while (::access(logPath(memtableId).c_str(), F_OK) == 0) {
+                WriteAheadLog replayed(logPath(memtableId));
+                replayed.replay([this] (const char* data, size_t n) {
+                    if (n != EntrySerializer::size)
+                        return;
+                    Entry entry;
+                    EntrySerializer::deserialize(data, entry);
+                    apply(entry);
+                });
+                memtableId++;
+            }
+
+            if (memtableRecords > 0) {
+                immutable = memtable;
+                immutableId = memtableId - 1;
+                memtable = std::make_shared<Memtable>();
+                memtableRecords = 0;
+                flushImmutable();
+            }
+            for (uint64_t id = first; id < memtableId; id++)
+                std::remove(logPath(id).c_str());
+        }
+
+        void apply(const Entry& entry) {
+            if (memtable->find(entry.key) == nullptr)
+                memtableRecords++;
+            memtable->insert(entry.key, std::make_pair(entry.value, entry.removed));
+        }
+
+        void put(const Entry& entry) {
+            std::lock_guard<std::mutex> writing(writer);
+            char buffer[EntrySerializer::size];
+            EntrySerializer::serialize(entry, buffer);
+            log->append(buffer, sizeof(buffer));
+
+            std::unique_lock<std::mutex> lock(mutex);
+            apply(entry);
+            if (memtableRecords >= MEMTABLE_RECORDS)
+                seal(lock);
+        }
+
+        // hands the memtable to the background task, once the previous one is written out
+        void seal(std::unique_lock<std::mutex>& lock) {
+            if (background.valid()) {
+                lock.unlock();
+                background.get();
+                lock.lock();
+            }
+
+            log->commit(); // the memtable stays recoverable until its run is in the manifest
+            immutable = memtable;
+            immutableId = memtableId;
+            memtable = std::make_shared<Memtable>();
+            memtableRecords = 0;
+            memtableId++;
+            log.reset(new WriteAheadLog(logPath(memtableId)));
+
+            background = AsyncIO::shared().pool().submit([this] {
+                flushImmutable();
+                compact();
+            });
+        }
+
+        // writes the sealed memtable out as a level 0 run
+        void flushImmutable() {
+            uint64_t id;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                id = nextRun++;
+            }
+
+            size_t records = 0;
+            auto it = immutable->cbegin(), end = immutable->cend();
+            Run::write(runPath(id), MEMTABLE_RECORDS, falsePositiveRate, [&it, &end, &records] (Entry& entry) {
+                if (it == end)
+                    return false;
+                entry.key = it->first;
+                entry.value = it->second->first;
+                entry.removed = it->second->second;
+                ++it;
+                records++;
+                return true;
+            });
+            auto run = std::make_shared<Run>(runPath(id), id);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (levels.empty())
+                levels.resize(1);
+            levels[0].insert(levels[0].begin(), run);
+            immutable.reset();
+            flushed = immutableId;
+            writeManifest();
+            std::remove(logPath(immutableId).c_str());
+        }
+
+        static size_t capacity(size_t level) {
+            size_t c = MEMTABLE_RECORDS;
+            for (size_t i = 0; i < level; i++)
+                c *= LEVEL_RATIO;
+            return c;
+        }
+
+        // merges every overfull level into the next one, from the top
+        void compact() {
+            for (size_t level = 0; ; level++) {
+                std::vector<std::shared_ptr<Run>> inputs;
+                bool bottom = true;
+                uint64_t id;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (level >= levels.size())
+                        return;
+                    bool overfull = level == 0 ? levels[0].size() >= L0_RUNS :
+                                    !levels[level].empty() && levels[level][0]->size() > capacity(level);
+                    if (!overfull)
+                        return;
+
+                    if (levels.size() <= level + 1)
+                        levels.resize(level + 2);
+                    inputs = levels[level];
+                    inputs.insert(inputs.end(), levels[level + 1].begin(), levels[level + 1].end());
+                    for (size_t below = level + 2; below < levels.size(); below++)
+                        bottom = bottom && levels[below].empty();
+                    id = nextRun++;
+                }
+
+                size_t written = merge(inputs, bottom, runPath(id));
+                std::shared_ptr<Run> run = written > 0 ? std::make_shared<Run>(runPath(id), id) : nullptr;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                levels[level].clear();
+                levels[level + 1].clear();
+                if (run)
+                    levels[level + 1].push_back(run);
+                writeManifest();
+                for (auto& input : inputs)
+                    input->retire();
+                if (!run) {
+                    std::remove(runPath(id).c_str());
+                    std::remove((runPath(id) + ".meta").c_str());
+                }
+            }
+        }
+
+        // writes the newest entry of every key of inputs (given newest first) as a run,
+        // dropping removed keys when nothing older lies below
+        size_t merge(const std::vector<std::shared_ptr<Run>>& inputs, bool dropRemoved, const std::string& out) {
+            Less less;
+            std::vector<typename RunFile::const_iterator> cursors, ends;
+            size_t total = 0;
+            for (const auto& run : inputs) {
+                cursors.push_back(run->begin());
+                ends.push_back(run->end());
+                total += run->size();
+            }
+
+            // smallest key first, and the newest input among equal keys
+            auto later = [&] (size_t a, size_t b) {
+                if (less(cursors[a]->key, cursors[b]->key))
+                    return false;
+                if (less(cursors[b]->key, cursors[a]->key))
+                    return true;
+                return a > b;
+            };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+            for (size_t i = 0; i < cursors.size(); i++) {
+                if (cursors[i] != ends[i])
+                    heap.push(i);
+            }
+
+            return Run::write(out, total, falsePositiveRate, [&] (Entry& entry) {
+                while (!heap.empty()) {
+                    size_t top = heap.top();
+                    heap.pop();
+                    entry = *cursors[top];
+
+                    // older versions of the same key are skipped
+                    while (!heap.empty() && !less(entry.key, cursors[heap.top()]->key)) {
+                        size_t older = heap.top();
+                        heap.pop();
+                        if (++cursors[older] != ends[older])
+                            heap.push(older);
+                    }
+                    if (++cursors[top] != ends[top])
+                        heap.push(top);
+
+                    if (!(entry.removed && dropRemoved))
+                        return true;
+                }
+                return false;
+            });
+        }
+
+    public:
+        // runs written from now on have filters at falsePositiveRate
+        LSMStore(const std::string& path, double falsePositiveRate = FALSE_POSITIVE_RATE)
+            : path(path), falsePositiveRate(falsePositiveRate), memtable(std::make_shared<Memtable>()),
+              memtableRecords(0), memtableId(0), immutableId(0), nextRun(0), flushed(0) {
+            readManifest();
+            recover();
+            log.reset(new WriteAheadLog(logPath(memtableId)));
+        }
+
+        // writes the memtable out, so that the next open replays nothing
+        virtual ~LSMStore() {
+            std::lock_guard<std::mutex> writing(writer);
+            if (background.valid())
+                background.wait();
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (memtableRecords > 0) {
+                seal(lock);
+                lock.unlock();
+                background.wait();
+                lock.lock();
+            }
+            log.reset();
+            std::remove(logPath(memtableId).c_str());
+        }
+
+        LSMStore(const LSMStore& other) = delete;
+        LSMStore& operator=(const LSMStore& other) = delete;
+
+        void insert(const K& key, const V& value) {
+            put(Entry{key, value, false});
+        }
+
+        void remove(const K& key) {
+            put(Entry{key, V(), true});
+        }
+
+        // makes every write so far durable
+        void commit() {
+            std::lock_guard<std::mutex> writing(writer);
+            log->commit();
+        }
+
+        bool find(const K& key, V& value) const {
+            std::vector<std::shared_ptr<Run>> runs;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto& table : {memtable, immutable}) {
+                    const std::pair<V, bool>* found = table ? table->find(key) : nullptr;
+                    if (found != nullptr) {
+                        if (found->second)
+                            return false;
+                        value = found->first;
+                        return true;
+                    }
+                }
+                for (const auto& level : levels)
+                    runs.insert(runs.end(), level.begin(), level.end());
+            }
+
+            Entry entry;
+            for (const auto& run : runs) {
+                if (run->find(key, entry)) {
+                    if (entry.removed)
+                        return false;
+                    value = entry.value;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        V at(const K& key) const {
+            V value;
+            if (!find(key, value))
+                throw std::out_of_range("key not found");
+            return value;
+        }
+
+        bool containsKey(const K& key) const {
+            V value;
+            return find(key, value);
+        }
+
+        // waits for the background flush and compactions to finish
+        void settle() {
+            std::lock_guard<std::mutex> writing(writer);
+            if (background.valid())
+                background.get();
+        }
+
+        size_t runCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t n = 0;
+            for (const auto& level : levels)
+                n += level.size();
+            return n;
+        }
+
+        template <typename K2, typename V2, class L2, class KS2, class VS2, class H2, class F2>
+        friend std::ostream& operator<<(std::ostream& os, const LSMStore<K2, V2, L2, KS2, VS2, H2, F2>& s);
+};
+
+template <typename K, typename V, class Less, class KeySerializer, class ValueSerializer, class Hash, class Filter>
+std::ostream& operator<<(std::ostream& os, const LSMStore<K, V, Less, KeySerializer, ValueSerializer, Hash, Filter>& s) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    os << "memtable: " << s.memtableRecords << " records";
+    for (size_t i = 0; i < s.levels.size(); i++) {
+        size_t entries = 0, filterBytes = 0;
+        for (const auto& run : s.levels[i]) {
+            entries += run->size();
+            filterBytes += run->filterBytes();
+        }
+        os << std::endl << "level " << i << ": " << s.levels[i].size() << " runs, " << entries << " entries, "
+           << filterBytes << " filter bytes";
+    }
+    return os;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef SERIALIZERS_INCLUDED
+#define SERIALIZERS_INCLUDED
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/* Serializers are stateless classes with static members only, so that storages
+   can call them without any virtual dispatch and know record sizes at compile time
+
+   constant size serializers
+       static constexpr size_t size
+       static void serialize(const T& in, char* out)
+       static void deserialize(const char* in, T& out)
+
+   variable size serializers
+       static size_t size(const T& in)
+       static void serialize(const T& in, char* out)
+       static void deserialize(const char* in, size_t size, T& out)
+
+   neither of them allocates: they always work on buffers given by the caller */
+
+template <class Serializer, typename T, typename = void>
+struct is_constant_size_serializer : std::false_type {};
+
+template <class Serializer, typename T>
+struct is_constant_size_serializer<Serializer, T, std::void_t<
+    std::integral_constant<size_t, Serializer::size>,
+    decltype(Serializer::serialize(std::declval<const T&>(), std::declval<char*>())),
+    decltype(Serializer::deserialize(std::declval<const char*>(), std::declval<T&>()))>> : std::true_type {};
+
+template <class Serializer, typename T, typename = void>
+struct is_variable_size_serializer : std::false_type {};
+
+template <class Serializer, typename T>
+struct is_variable_size_serializer<Serializer, T, std::void_t<
+    decltype(Serializer::size(std::declval<const T&>())),
+    decltype(Serializer::serialize(std::declval<const T&>(), std::declval<char*>())),
+    decltype(Serializer::deserialize(std::declval<const char*>(), size_t(), std::declval<T&>()))>> : std::true_type {};
+
+// Copies the object representation of trivially copyable types
+template <typename T>
+struct BinarySerializer {
+    static_assert(std::is_trivially_copyable<T>::value, "BinarySerializer needs a trivially copyable type");
+
+    static constexpr size_t size = sizeof(T);
+
+    static void serialize(const T& in, char* out) {
+        std::memcpy(out, &in, sizeof(T));
+    }
+
+    static void deserialize(const char* in, T& out) {
+        std::memcpy(&out, in, sizeof(T));
+    }
+};
+
+// Lays the two halves of a pair out one after the other
+template <typename A,
+          typename B,
+          class SerializerA = BinarySerializer<A>,
+          class SerializerB = BinarySerializer<B>>
+struct PairSerializer {
+    static_assert(is_constant_size_serializer<SerializerA, A>::value &&
+                  is_constant_size_serializer<SerializerB, B>::value,
+                  "PairSerializer needs constant size serializers");
+
+    static constexpr size_t size = SerializerA::size + SerializerB::size;
+
+    static void serialize(const std::pair<A, B>& in, char* out) {
+        SerializerA::serialize(in.first, out);
+        SerializerB::serialize(in.second, out + SerializerA::size);
+    }
+
+    static void deserialize(const char* in, std::pair<A, B>& out) {
+        SerializerA::deserialize(in, out.first);
+        SerializerB::deserialize(in + SerializerA::size, out.second);
+    }
+};
+
+struct StringSerializer {
+    static size_t size(const std::string& in) {
+        return in.size();
+    }
+
+    static void serialize(const std::string& in, char* out) {
+        in.copy(out, in.size());
+    }
+
+    static void deserialize(const char* in, size_t size, std::string& out) {
+        out.assign(in, size);
+    }
+};
+
+// Helpers shared by the storages, with a memcpy fast path for binary serializers
+template <typename T,
+          class Serializer>
+struct SerializerTraits {
+    static constexpr bool constantSize = is_constant_size_serializer<Serializer, T>::value;
+    static constexpr bool variableSize = is_variable_size_serializer<Serializer, T>::value;
+
+    // whether the encoding of an object is its object representation
+    static constexpr bool binary = std::is_same<Serializer, BinarySerializer<T>>::value;
+
+    static T deserialize(const char* in) {
+        T out;
+        Serializer::deserialize(in, out);
+        return out;
+    }
+
+    static T deserialize(const char* in, size_t size) {
+        T out;
+        Serializer::deserialize(in, size, out);
+        return out;
+    }
+
+    // encodes n objects, stride bytes apart in out
+    static void serialize(const T* in, size_t n, char* out, size_t stride = Serializer::size) {
+        if constexpr (binary) {
+            if (stride == Serializer::size) {
+                std::memcpy(out, in, n * Serializer::size);
+                return;
+            }
+        }
+        for (size_t i = 0; i < n; i++)
+            Serializer::serialize(in[i], out + i * stride);
+    }
+
+    // decodes n objects, stride bytes apart in in
+    static void deserialize(const char* in, size_t n, T* out, size_t stride = Serializer::size) {
+        if constexpr (binary) {
+            if (stride == Serializer::size) {
+                std::memcpy(out, in, n * Serializer::size);
+                return;
+            }
+        }
+        for (size_t i = 0; i < n; i++)
+            Serializer::deserialize(in + i * stride, out[i]);
+    }
+};
+
+#endif
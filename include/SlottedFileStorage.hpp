@@ -0,0 +1,576 @@
+#ifndef SLOTTEDFILESTORAGE_INCLUDED
+#define SLOTTEDFILESTORAGE_INCLUDED
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "FileIO.hpp"
+#include "Serializers.hpp"
+#include "Checksum.hpp"
+
+/* FILE FORMAT
+   (PAGE_SIZE) header page holding a StorageHeader
+   (PAGE_SIZE)[] pages, each one either
+       slotted:  (PageHeader) header, (Slot)[] slot directory growing forwards,
+                 free space, record data growing backwards from the end of the page
+       overflow: (PageHeader) header, part of the payload of an oversized record
+       free:     (PageHeader) header, linked into the free page list
+
+   slots of oversized records hold an OverflowStub pointing to their overflow chain
+
+   FREE SPACE MAP FORMAT (path + ".fsm")
+   (uint64_t) generation of the header it was written with
+   (uint32_t) page count
+   (uint32_t) CRC32C of the free bytes
+   (uint16_t)[] free bytes in each page
+
+   the map is only trusted when it matches the generation of the header, which every
+   flush advances, so that a map left behind by a crash is rebuilt from the pages */
+
+struct RecordId {
+    RecordId(uint32_t page = 0, uint16_t slot = 0) : page(page), slot(slot) {}
+
+    uint32_t page;
+    uint16_t slot;
+
+    bool operator==(const RecordId& other) const {
+        return page == other.page && slot == other.slot;
+    }
+
+    bool operator!=(const RecordId& other) const {
+        return !(*this == other);
+    }
+
+    bool operator<(const RecordId& other) const {
+        return page < other.page || (page == other.page && slot < other.slot);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const RecordId& id) {
+        os << "(" << id.page << ", " << id.slot << ")";
+        return os;
+    }
+};
+
+// Stores variable size records in fixed size slotted pages. Records are
+// addressed by a RecordId that stays the same across updates, even when the
+// record grows out of its page and has to be moved to an overflow chain
+template <typename T,
+          class Serializer = StringSerializer>
+class SlottedFileStorage {
+    public:
+        static constexpr size_t PAGE_SIZE = 4096;
+
+        SlottedFileStorage(const std::string& path, size_t cachePages = 64)
+            : file(path), cachePages(std::max<size_t>(cachePages, 1))
+        {
+            static_assert(SerializerTraits<T, Serializer>::variableSize, "Serializer must be a variable size serializer");
+            static_assert(PAGE_SIZE < OVERFLOW_FLAG, "slot lengths must fit in 15 bits");
+
+            if (file.size() < PAGE_SIZE) { // if file is new, creates its header page
+                storageHeader = StorageHeader();
+                writeHeader();
+            }
+            else
+                file.read(0, reinterpret_cast<char*>(&storageHeader), sizeof(StorageHeader));
+
+            loadFreeSpace();
+        }
+
+        virtual ~SlottedFileStorage() {
+            if (file.isOpen())
+                flush();
+        }
+
+        SlottedFileStorage(const SlottedFileStorage& other) = delete;
+        SlottedFileStorage& operator=(const SlottedFileStorage& other) = delete;
+
+        SlottedFileStorage(SlottedFileStorage&& other) = default;
+
+        size_t size() const {
+            return storageHeader.records;
+        }
+
+        bool empty() const {
+            return storageHeader.records == 0;
+        }
+
+        size_t pageCount() const {
+            return storageHeader.pages;
+        }
+
+        bool valid(const RecordId& id) const {
+            if (id.page == 0 || id.page >= storageHeader.pages)
+                return false;
+
+            const char* p = page(id.page);
+            const PageHeader& h = header(p);
+            return h.type == SLOTTED_PAGE && id.slot < h.slotCount && slot(p, id.slot).offset != 0;
+        }
+
+        RecordId insert(const T& data) {
+            evict();
+            Encoded encoded = encode(serialize(data), maxInline());
+            const size_t n = footprint(encoded.bytes.size());
+
+            uint32_t pageNo;
+            uint16_t slotNo;
+            while (true) {
+                pageNo = findPage(n + sizeof(Slot));
+                const char* p = page(pageNo);
+                const PageHeader& h = header(p);
+
+                slotNo = 0;
+                while (slotNo < h.slotCount && slot(p, slotNo).offset != 0)
+                    slotNo++;
+                size_t need = n + (slotNo == h.slotCount ? sizeof(Slot) : 0);
+                if (h.type == SLOTTED_PAGE && freeSpace(p) >= need)
+                    break;
+
+                // the map promised more than the page has, so it is corrected and another page is tried
+                updateFreeSpace(pageNo);
+            }
+
+            place(pageNo, slotNo, encoded);
+            storageHeader.records++;
+            return RecordId(pageNo, slotNo);
+        }
+
+        T read(const RecordId& id) const {
+            check(id);
+            evictClean();
+
+            const char* p = page(id.page);
+            const Slot& s = slot(p, id.slot);
+            if (!(s.length & OVERFLOW_FLAG))
+                return SerializerTraits<T, Serializer>::deserialize(p + s.offset, s.length);
+
+            OverflowStub stub;
+            std::memcpy(&stub, p + s.offset, sizeof(OverflowStub));
+            std::vector<char> bytes = readOverflow(stub);
+            return SerializerTraits<T, Serializer>::deserialize(bytes.data(), bytes.size());
+        }
+
+        void update(const RecordId& id, const T& data) {
+            check(id);
+            evict();
+
+            release(id);
+
+            // records that no longer fit in their page are moved to an overflow
+            // chain so that their id does not change
+            place(id.page, id.slot, encode(serialize(data), freeSpace(page(id.page))));
+        }
+
+        void remove(const RecordId& id) {
+            check(id);
+            evict();
+
+            release(id);
+
+            // trailing empty slots are given back to the page
+            PageHeader& h = header(page(id.page));
+            while (h.slotCount > 0 && slot(page(id.page), h.slotCount - 1).offset == 0)
+                h.slotCount--;
+
+            updateFreeSpace(id.page);
+            storageHeader.records--;
+        }
+
+        void foreach(std::function<void(const RecordId&, const T&)> operation) const {
+            for (uint32_t pageNo = 1; pageNo < storageHeader.pages; pageNo++) {
+                // reads may evict the page, so it is looked up again for every slot
+                for (uint16_t slotNo = 0; slotNo < header(page(pageNo)).slotCount; slotNo++) {
+                    if (valid(RecordId(pageNo, slotNo)))
+                        operation(RecordId(pageNo, slotNo), read(RecordId(pageNo, slotNo)));
+                }
+            }
+        }
+
+        // writes the dirty pages, the header and the free space map back to the file.
+        // the header moves on to a new generation, which only the map written after it matches
+        void flush() {
+            // a crash amid the pages must not leave a map that still matches the old header
+            if (!dirty.empty())
+                File(freeSpacePath()).truncate(0);
+            for (uint32_t pageNo : dirty)
+                file.write(pageNo * PAGE_SIZE, cache.at(pageNo).data(), PAGE_SIZE);
+            dirty.clear();
+
+            storageHeader.generation++;
+            writeHeader();
+            writeFreeSpace();
+        }
+
+        // flushes and waits until the data reaches the disk
+        void sync() {
+            flush();
+            file.sync();
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const SlottedFileStorage<T, Serializer>& s) {
+            os << "records: " << s.size() << std::endl;
+            os << "pages: " << s.pageCount() << std::endl;
+            s.foreach([&os] (const RecordId& id, const T& data) {
+                os << id << " " << data << std::endl;
+            });
+
+            return os;
+        }
+
+    private:
+        enum PageType : uint8_t { FREE_PAGE, SLOTTED_PAGE, OVERFLOW_PAGE };
+
+        static constexpr uint16_t OVERFLOW_FLAG = 0x8000;
+        static constexpr uint32_t NO_PAGE = 0; // page 0 is the header, so it never is in a chain
+
+        struct StorageHeader {
+            StorageHeader() : pages(1), freePage(NO_PAGE), records(0), generation(0) {}
+
+            uint32_t pages;
+            uint32_t freePage;
+            uint64_t records;
+            uint64_t generation; // of the last flush
+        };
+
+        struct FreeSpaceHeader {
+            uint64_t generation;
+            uint32_t pages;
+            uint32_t checksum;
+        };
+
+        struct PageHeader {
+            uint8_t type;
+            uint16_t slotCount; // slotted pages
+            uint16_t dataStart; // slotted pages, where the record data begins
+            uint16_t used;      // overflow pages, payload bytes in the page
+            uint32_t next;      // overflow and free pages, next page in the chain
+        };
+
+        struct Slot {
+            uint16_t offset;    // 0 for empty slots
+            uint16_t length;    // OVERFLOW_FLAG is set when the slot holds an OverflowStub
+        };
+
+        struct OverflowStub {
+            uint32_t page;
+            uint32_t padding;
+            uint64_t length;
+        };
+
+        // what is kept in a slot: the record itself or the stub of its overflow chain
+        struct Encoded {
+            std::vector<char> bytes;
+            bool overflow;
+        };
+
+        File file;
+        StorageHeader storageHeader;
+
+        // write-back page cache
+        size_t cachePages;
+        mutable std::unordered_map<uint32_t, std::vector<char>> cache;
+        std::set<uint32_t> dirty;
+
+        // free bytes of each slotted page, also indexed by (free bytes, page) for best fit lookups
+        std::vector<uint16_t> freeBytes;
+        std::set<std::pair<uint16_t, uint32_t>> pagesBySpace;
+
+        static PageHeader& header(char* p) {
+            return *reinterpret_cast<PageHeader*>(p);
+        }
+
+        static const PageHeader& header(const char* p) {
+            return *reinterpret_cast<const PageHeader*>(p);
+        }
+
+        static Slot& slot(char* p, uint16_t slotNo) {
+            return reinterpret_cast<Slot*>(p + sizeof(PageHeader))[slotNo];
+        }
+
+        static const Slot& slot(const char* p, uint16_t slotNo) {
+            return reinterpret_cast<const Slot*>(p + sizeof(PageHeader))[slotNo];
+        }
+
+        static constexpr size_t maxInline() {
+            return PAGE_SIZE - sizeof(PageHeader) - sizeof(Slot);
+        }
+
+        static constexpr size_t overflowPayload() {
+            return PAGE_SIZE - sizeof(PageHeader);
+        }
+
+        // every inline record takes at least the space of a stub, so that it can always be spilled in place
+        static size_t footprint(size_t length) {
+            return std::max(length, sizeof(OverflowStub));
+        }
+
+        static size_t freeSpace(const char* p) {
+            const PageHeader& h = header(p);
+            size_t used = sizeof(PageHeader) + h.slotCount * sizeof(Slot);
+            for (uint16_t slotNo = 0; slotNo < h.slotCount; slotNo++) {
+                const Slot& s = slot(p, slotNo);
+                if (s.offset != 0)
+                    used += footprint(s.length & ~OVERFLOW_FLAG);
+            }
+            return PAGE_SIZE - used;
+        }
+
+        void check(const RecordId& id) const {
+            if (!valid(id))
+                throw std::out_of_range("invalid record id");
+        }
+
+        const char* page(uint32_t pageNo) const {
+            auto it = cache.find(pageNo);
+            if (it == cache.end()) {
+                it = cache.emplace(pageNo, std::vector<char>(PAGE_SIZE)).first;
+                file.read(pageNo * PAGE_SIZE, it->second.data(), PAGE_SIZE);
+            }
+            return it->second.data();
+        }
+
+        // pages are only evicted between operations, so pointers into the cache
+        // stay valid for the whole operation that got them
+        char* page(uint32_t pageNo) {
+            const char* p = static_cast<const SlottedFileStorage*>(this)->page(pageNo);
+            dirty.insert(pageNo);
+            return const_cast<char*>(p);
+        }
+
+        void evict() {
+            if (cache.size() < cachePages)
+                return;
+
+            flush();
+            cache.clear();
+        }
+
+        void evictClean() const {
+            if (cache.size() < cachePages)
+                return;
+
+            for (auto it = cache.begin(); it != cache.end(); ) {
+                if (dirty.count(it->first) == 0)
+                    it = cache.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        uint32_t allocatePage(PageType type) {
+            uint32_t pageNo = storageHeader.freePage;
+            if (pageNo != NO_PAGE)
+                storageHeader.freePage = header(page(pageNo)).next;
+            else {
+                pageNo = storageHeader.pages++;
+                freeBytes.resize(storageHeader.pages, 0);
+            }
+
+            char* p = page(pageNo);
+            std::fill(p, p + PAGE_SIZE, 0);
+            PageHeader& h = header(p);
+            h.type = type;
+            h.dataStart = PAGE_SIZE;
+            h.next = NO_PAGE;
+            return pageNo;
+        }
+
+        void freePage(uint32_t pageNo) {
+            PageHeader& h = header(page(pageNo));
+            h.type = FREE_PAGE;
+            h.next = storageHeader.freePage;
+            storageHeader.freePage = pageNo;
+        }
+
+        // best fit slotted page with at least need free bytes, creating one if none has
+        uint32_t findPage(size_t need) {
+            auto it = pagesBySpace.lower_bound(std::make_pair(static_cast<uint16_t>(need), 0u));
+            if (it != pagesBySpace.end())
+                return it->second;
+
+            uint32_t pageNo = allocatePage(SLOTTED_PAGE);
+            updateFreeSpace(pageNo);
+            return pageNo;
+        }
+
+        void updateFreeSpace(uint32_t pageNo) {
+            pagesBySpace.erase(std::make_pair(freeBytes[pageNo], pageNo));
+            const char* p = page(pageNo);
+            freeBytes[pageNo] = header(p).type == SLOTTED_PAGE ? freeSpace(p) : 0;
+            pagesBySpace.insert(std::make_pair(freeBytes[pageNo], pageNo));
+        }
+
+        // moves the live records of a page to its end, merging the holes between them
+        void compactPage(char* p) {
+            std::vector<char> copy(p, p + PAGE_SIZE);
+            PageHeader& h = header(p);
+            h.dataStart = PAGE_SIZE;
+            for (uint16_t slotNo = 0; slotNo < h.slotCount; slotNo++) {
+                Slot& s = slot(p, slotNo);
+                if (s.offset == 0)
+                    continue;
+
+                size_t n = footprint(s.length & ~OVERFLOW_FLAG);
+                h.dataStart -= n;
+                std::memcpy(p + h.dataStart, copy.data() + s.offset, n);
+                s.offset = h.dataStart;
+            }
+        }
+
+        // stores an encoded record in an empty slot of the page, which must have room for it
+        void place(uint32_t pageNo, uint16_t slotNo, const Encoded& encoded) {
+            char* p = page(pageNo);
+            PageHeader& h = header(p);
+            size_t n = footprint(encoded.bytes.size());
+
+            size_t directory = sizeof(PageHeader) + std::max<size_t>(h.slotCount, slotNo + 1) * sizeof(Slot);
+            if (h.dataStart < directory + n)
+                compactPage(p);
+            if (h.dataStart < directory + n)
+                throw std::logic_error("no room for the record in page " + std::to_string(pageNo));
+            h.slotCount = std::max<uint16_t>(h.slotCount, slotNo + 1);
+
+            h.dataStart -= n;
+            std::copy(encoded.bytes.begin(), encoded.bytes.end(), p + h.dataStart);
+            slot(p, slotNo).offset = h.dataStart;
+            slot(p, slotNo).length = encoded.bytes.size() | (encoded.overflow ? OVERFLOW_FLAG : 0);
+
+            updateFreeSpace(pageNo);
+        }
+
+        static std::vector<char> serialize(const T& data) {
+            std::vector<char> bytes(Serializer::size(data));
+            Serializer::serialize(data, bytes.data());
+            return bytes;
+        }
+
+        // keeps the record inline if it takes at most available bytes, spilling it to an overflow chain otherwise
+        Encoded encode(const std::vector<char>& bytes, size_t available) {
+            if (bytes.size() <= maxInline() && footprint(bytes.size()) <= available)
+                return Encoded { bytes, false };
+
+            OverflowStub stub;
+            stub.page = writeOverflow(bytes);
+            stub.padding = 0;
+            stub.length = bytes.size();
+
+            Encoded encoded { std::vector<char>(sizeof(OverflowStub)), true };
+            std::memcpy(encoded.bytes.data(), &stub, sizeof(OverflowStub));
+            return encoded;
+        }
+
+        uint32_t writeOverflow(const std::vector<char>& bytes) {
+            uint32_t first = NO_PAGE, last = NO_PAGE;
+            for (size_t done = 0; done < bytes.size(); ) {
+                uint32_t pageNo = allocatePage(OVERFLOW_PAGE);
+                if (last == NO_PAGE)
+                    first = pageNo;
+                else
+                    header(page(last)).next = pageNo;
+
+                char* p = page(pageNo);
+                size_t n = std::min(overflowPayload(), bytes.size() - done);
+                std::memcpy(p + sizeof(PageHeader), bytes.data() + done, n);
+                header(p).used = n;
+
+                done += n;
+                last = pageNo;
+            }
+            return first;
+        }
+
+        std::vector<char> readOverflow(const OverflowStub& stub) const {
+            std::vector<char> bytes;
+            bytes.reserve(stub.length);
+            for (uint32_t pageNo = stub.page; pageNo != NO_PAGE; ) {
+                const char* p = page(pageNo);
+                bytes.insert(bytes.end(), p + sizeof(PageHeader), p + sizeof(PageHeader) + header(p).used);
+                pageNo = header(p).next;
+            }
+            return bytes;
+        }
+
+        // empties the slot of a record, freeing its overflow chain if it has one
+        void release(const RecordId& id) {
+            char* p = page(id.page);
+            Slot& s = slot(p, id.slot);
+            if (s.length & OVERFLOW_FLAG) {
+                OverflowStub stub;
+                std::memcpy(&stub, p + s.offset, sizeof(OverflowStub));
+                for (uint32_t pageNo = stub.page; pageNo != NO_PAGE; ) {
+                    uint32_t next = header(page(pageNo)).next;
+                    freePage(pageNo);
+                    pageNo = next;
+                }
+            }
+
+            s.offset = 0;
+            s.length = 0;
+        }
+
+        std::string freeSpacePath() const {
+            return file.name() + ".fsm";
+        }
+
+        // loads the free space map, rebuilding it from the pages when it is missing, of
+        // another generation than the header, or torn
+        void loadFreeSpace() {
+            freeBytes.assign(storageHeader.pages, 0);
+
+            bool loaded = false;
+            if (::access(freeSpacePath().c_str(), F_OK) == 0) {
+                File fsmFile(freeSpacePath());
+                const size_t bytes = storageHeader.pages * sizeof(uint16_t);
+                FreeSpaceHeader fsmHeader;
+                if (fsmFile.size() == sizeof(FreeSpaceHeader) + bytes) {
+                    fsmFile.read(0, reinterpret_cast<char*>(&fsmHeader), sizeof(FreeSpaceHeader));
+                    if (fsmHeader.generation == storageHeader.generation && fsmHeader.pages == storageHeader.pages) {
+                        fsmFile.read(sizeof(FreeSpaceHeader), reinterpret_cast<char*>(freeBytes.data()), bytes);
+                        loaded = fsmHeader.checksum == CRC32C::compute(reinterpret_cast<const char*>(freeBytes.data()), bytes);
+                    }
+                }
+            }
+
+            for (uint32_t pageNo = 1; pageNo < storageHeader.pages; pageNo++) {
+                if (!loaded) {
+                    // read through the const overload, so that the pages dropped from the cache are not left dirty
+                    const char* p = static_cast<const SlottedFileStorage*>(this)->page(pageNo);
+                    freeBytes[pageNo] = header(p).type == SLOTTED_PAGE ? freeSpace(p) : 0;
+                    if (cache.size() >= cachePages)
+                        cache.clear();
+                }
+                if (freeBytes[pageNo] > 0)
+                    pagesBySpace.insert(std::make_pair(freeBytes[pageNo], pageNo));
+            }
+        }
+
+        void writeFreeSpace() {
+            File fsmFile(freeSpacePath());
+            const size_t bytes = storageHeader.pages * sizeof(uint16_t);
+            FreeSpaceHeader fsmHeader;
+            fsmHeader.generation = storageHeader.generation;
+            fsmHeader.pages = storageHeader.pages;
+            fsmHeader.checksum = CRC32C::compute(reinterpret_cast<const char*>(freeBytes.data()), bytes);
+            fsmFile.write(0, reinterpret_cast<const char*>(&fsmHeader), sizeof(FreeSpaceHeader));
+            fsmFile.write(sizeof(FreeSpaceHeader), reinterpret_cast<const char*>(freeBytes.data()), bytes);
+            fsmFile.truncate(sizeof(FreeSpaceHeader) + bytes);
+        }
+
+        void writeHeader() {
+            std::vector<char> raw(PAGE_SIZE);
+            std::memcpy(raw.data(), &storageHeader, sizeof(StorageHeader));
+            file.write(0, raw.data(), PAGE_SIZE);
+        }
+};
+
+#endif
@@ -5,11 +5,84 @@
 #include <cstddef>
 #include <stdexcept>
 #include <utility>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <functional>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__AVX2__) && SIZE_MAX == UINT64_MAX
+#define SPARSEMATRIX_AVX2
+#include <immintrin.h>
+#endif
 
 #include "AVLKVStore.hpp"
+#include "FileIO.hpp"
+#include "Checksum.hpp"
+
+template <typename T, size_t B>
+class BlockSparseMatrix;
+
+/* A matrix which stores only the cells differing from its default value.
+   it is mutable while kept in trees: a tree of columns per row owns the values, and a
+   cross index of rows per column points at them, so that columns are walked as cheaply
+   as rows. freeze packs it into compressed arrays for reads, either by rows (CSR) or
+   by columns (CSC):
+
+       offsets   (size_t)[lines + 1]  entries of line i lie in [offsets[i], offsets[i + 1])
+       indices   (size_t)[entries]    column (CSR) or row (CSC) of each entry, ascending per line
+       values    (T)[entries]
+
+   a frozen matrix is read only until thaw puts it back into trees. products run over
+   frozen matrices, and take the default value as zero.
 
+   save writes the arrays out as they are, so that map can use them from the file
+   without parsing or copying them
+
+   FORMAT (version 2)
+   (BinaryHeader)  magic, version, layout, sizeof(T), width, height, entries,
+                   CRC32C of the default value and the arrays, checksum
+   (T)             default value
+   (size_t)[]      offsets, at the next multiple of ALIGNMENT
+   (size_t)[]      indices, at the next multiple of ALIGNMENT
+   (T)[]           values, at the next multiple of ALIGNMENT */
 template <typename T>
 class SparseMatrix {
+    // shares the partitioning and sorting of work over threads
+    template <typename U, size_t B>
+    friend class BlockSparseMatrix;
+
+    public:
+        enum Layout {
+            TREES,
+            CSR,
+            CSC
+        };
+
+        struct Triplet {
+            size_t row, col;
+            T value;
+        };
+
+        // a cell of a row (index is its column) or of a column (index is its row)
+        struct Entry {
+            size_t index;
+            const T& value;
+        };
+
     protected:
         T defaultValue;
 
@@ -20,14 +93,592 @@ class SparseMatrix {
         
         Rows rows;
 
+        typedef AVLKVStore<size_t, T*> ColRows; // into the values of rows
+        typedef AVLKVStore<size_t, ColRows> Columns;
+
+        Columns columns;
+
+        // an array which is either owned, or a view of memory held by mapping
+        template <typename U>
+        class Array {
+            protected:
+                std::vector<U> owned;
+                const U* view;
+                size_t viewSize;
+
+            public:
+                Array() : view(nullptr), viewSize(0) {};
+
+                Array(std::vector<U>&& owned) : owned(std::move(owned)), view(nullptr), viewSize(0) {};
+
+                Array(const U* view, size_t n) : view(view), viewSize(n) {};
+
+                const U* data() const {
+                    return view != nullptr ? view : owned.data();
+                }
+
+                size_t size() const {
+                    return view != nullptr ? viewSize : owned.size();
+                }
+
+                const U& operator[](size_t i) const {
+                    return data()[i];
+                }
+
+                // views are of private mappings, which may be written without reaching the file
+                U& operator[](size_t i) {
+                    return const_cast<U*>(data())[i];
+                }
+
+                const U& back() const {
+                    return data()[size() - 1];
+                }
+        };
+
+        Layout _layout;
+        Array<size_t> offsets;
+        Array<size_t> indices;
+        Array<T> values;
+        std::shared_ptr<Mapping> mapping; // of the file the arrays view, if they do
+
+        void checkMutable() const {
+            if (_layout != TREES)
+                throw std::logic_error("matrix is frozen");
+        }
+
+        // removes the cell at (y, x) from rows and columns, if it is there
+        void erase(size_t y, size_t x) {
+            Cols* row = rows.find(y);
+            if (row == nullptr || !row->remove(x))
+                return;
+            if (row->empty())
+                rows.remove(y);
+
+            ColRows* col = columns.find(x);
+            col->remove(y);
+            if (col->empty())
+                columns.remove(x);
+        }
+
+        // the value at (y, x) in trees, or nullptr, in one descent into the rows and one into the row
+        T* cellOf(size_t y, size_t x) const {
+            const Cols* row = rows.find(y);
+            return row == nullptr ? nullptr : const_cast<T*>(row->find(x));
+        }
+
+        // rebuilds the columns out of the rows, in O(entries + width)
+        void indexColumns() {
+            // counting sort by column, keeping rows in order within each
+            std::vector<size_t> starts(_width + 1, 0);
+            for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                    starts[c->first + 1]++;
+            }
+            for (size_t x = 0; x < _width; x++)
+                starts[x + 1] += starts[x];
+
+            std::vector<std::pair<size_t, T*>> cells(starts.back());
+            std::vector<size_t> next(starts.begin(), starts.end() - 1);
+            for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                    cells[next[c->first]++] = std::pair<size_t, T*>(r->first, c->second.get());
+            }
+
+            std::vector<std::pair<size_t, ColRows>> built;
+            for (size_t x = 0; x < _width; x++) {
+                if (starts[x + 1] > starts[x])
+                    built.emplace_back(x, ColRows::fromSorted(cells.cbegin() + starts[x], starts[x + 1] - starts[x]));
+            }
+            columns = Columns::fromSorted(std::make_move_iterator(built.begin()), built.size());
+        }
+
+        static const T& valueOf(const T& value) {
+            return value;
+        }
+
+        static const T& valueOf(T* const& value) {
+            return *value;
+        }
+
+        // index of the entry at (y, x) in the compressed arrays, or values.size()
+        size_t entryOf(size_t y, size_t x) const {
+            size_t line = _layout == CSR ? y : x,
+                   index = _layout == CSR ? x : y;
+            if (line + 1 >= offsets.size())
+                return values.size();
+
+            const size_t* first = indices.data() + offsets[line];
+            const size_t* last = indices.data() + offsets[line + 1];
+            const size_t* it = std::lower_bound(first, last, index);
+            if (it == last || *it != index)
+                return values.size();
+            return static_cast<size_t>(it - indices.data());
+        }
+
+        // reads sorted triplets as (col, value) pairs
+        struct CellReader {
+            const Triplet* t;
+
+            CellReader(const Triplet* t) : t(t) {};
+
+            std::pair<size_t, T> operator*() const {
+                return std::pair<size_t, T>(t->col, t->value);
+            }
+
+            CellReader& operator++() {
+                ++t;
+                return *this;
+            }
+        };
+
+        struct BinaryHeader {
+            BinaryHeader()
+                : magic(MAGIC), version(VERSION), layout(0), valueSize(sizeof(T)),
+                  width(0), height(0), entries(0), arraysChecksum(0), checksum(0) {}
+
+            uint64_t magic;
+            uint32_t version;
+            uint32_t layout;
+            uint64_t valueSize;
+            uint64_t width;
+            uint64_t height;
+            uint64_t entries;
+            uint32_t arraysChecksum;
+            uint32_t checksum; // of every field above
+
+            uint32_t compute() const {
+                return CRC32C::compute(reinterpret_cast<const char*>(this), offsetof(BinaryHeader, checksum));
+            }
+
+            operator const char*() const {
+                return reinterpret_cast<const char*>(this);
+            }
+
+            operator char*() {
+                return reinterpret_cast<char*>(this);
+            }
+        };
+
+        static size_t aligned(size_t offset) {
+            return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        }
+
+        // where the default value, offsets, indices and values of a binary file start,
+        // and where it ends
+        static void binaryLayout(size_t lines, size_t entries, size_t* at) {
+            at[0] = sizeof(BinaryHeader);
+            at[1] = aligned(at[0] + sizeof(T));
+            at[2] = aligned(at[1] + (lines + 1) * sizeof(size_t));
+            at[3] = aligned(at[2] + entries * sizeof(size_t));
+            at[4] = at[3] + entries * sizeof(T);
+        }
+
+        // CRC32C of what save writes after the header
+        static uint32_t arraysChecksum(const T& defaultValue, const size_t* offsets, size_t lines,
+                                       const size_t* indices, const T* values, size_t entries) {
+            uint32_t crc = CRC32C::compute(reinterpret_cast<const char*>(&defaultValue), sizeof(T));
+            crc = CRC32C::compute(reinterpret_cast<const char*>(offsets), (lines + 1) * sizeof(size_t), crc);
+            crc = CRC32C::compute(reinterpret_cast<const char*>(indices), entries * sizeof(size_t), crc);
+            return CRC32C::compute(reinterpret_cast<const char*>(values), entries * sizeof(T), crc);
+        }
+
+        // the line at p, without its end, moving p past it
+        static std::string nextLine(const char*& p, const char* end) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (eol == nullptr)
+                eol = end;
+            std::string line(p, eol);
+            p = eol == end ? end : eol + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return line;
+        }
+
+        static void skipBlanks(const char*& p, const char* end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+        }
+
+        static bool parseIndex(const char*& p, const char* end, size_t& out) {
+            skipBlanks(p, end);
+            const char* start = p;
+            out = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+                out = out * 10 + static_cast<size_t>(*p++ - '0');
+            return p != start;
+        }
+
+        // the file is not null terminated, so the number is copied out for strtod
+        static bool parseValue(const char*& p, const char* end, T& out) {
+            skipBlanks(p, end);
+            char number[64];
+            size_t n = 0;
+            while (p < end && n + 1 < sizeof(number) && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                number[n++] = *p++;
+            number[n] = '\0';
+
+            char* stop;
+            if (std::is_integral<T>::value)
+                out = static_cast<T>(std::strtoll(number, &stop, 10));
+            else
+                out = static_cast<T>(std::strtod(number, &stop));
+            return n > 0 && *stop == '\0';
+        }
+
+        template <typename Combine>
+        static SparseMatrix fromCells(std::vector<Triplet>&& cells, const T& defaultValue, size_t w, size_t h,
+                                      Combine combine, Layout layout, unsigned int threads) {
+            for (const Triplet& t : cells) {
+                if (t.row >= h || t.col >= w)
+                    throw std::invalid_argument("invalid matrix coordinates");
+            }
+
+            // sorted by rows, but for CSC
+            if (layout == CSC) {
+                parallelSort(cells.begin(), cells.end(), [](const Triplet& a, const Triplet& b) {
+                    return a.col < b.col || (a.col == b.col && a.row < b.row);
+                }, threads);
+            }
+            else {
+                parallelSort(cells.begin(), cells.end(), [](const Triplet& a, const Triplet& b) {
+                    return a.row < b.row || (a.row == b.row && a.col < b.col);
+                }, threads);
+            }
+
+            // fold duplicates, and drop cells which come out as the default value
+            size_t n = 0;
+            for (size_t i = 0; i < cells.size(); ) {
+                Triplet t = cells[i++];
+                while (i < cells.size() && cells[i].row == t.row && cells[i].col == t.col)
+                    t.value = combine(t.value, cells[i++].value);
+                if (!(t.value == defaultValue))
+                    cells[n++] = t;
+            }
+            cells.erase(cells.begin() + n, cells.end());
+
+            SparseMatrix m(defaultValue, w, h);
+            if (layout != TREES) {
+                const size_t lines = layout == CSR ? h : w;
+                std::vector<size_t> o(lines + 1, 0);
+                std::vector<size_t> ind(cells.size());
+                std::vector<T> val(cells.size(), defaultValue);
+                for (size_t i = 0; i < cells.size(); i++) {
+                    o[(layout == CSR ? cells[i].row : cells[i].col) + 1]++;
+                    ind[i] = layout == CSR ? cells[i].col : cells[i].row;
+                    val[i] = cells[i].value;
+                }
+                for (size_t i = 0; i < lines; i++)
+                    o[i + 1] += o[i];
+
+                m._layout = layout;
+                m.offsets = Array<size_t>(std::move(o));
+                m.indices = Array<size_t>(std::move(ind));
+                m.values = Array<T>(std::move(val));
+                return m;
+            }
+
+            // the first cell of every row
+            std::vector<size_t> starts;
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (i == 0 || cells[i].row != cells[i - 1].row)
+                    starts.push_back(i);
+            }
+            starts.push_back(cells.size());
+
+            std::vector<std::pair<size_t, Cols>> built(starts.size() - 1);
+            runParts(partition(starts, threads), [&cells, &starts, &built](size_t, size_t from, size_t to) {
+                for (size_t r = from; r < to; r++) {
+                    built[r].first = cells[starts[r]].row;
+                    built[r].second = Cols::fromSorted(CellReader(cells.data() + starts[r]), starts[r + 1] - starts[r]);
+                }
+            });
+
+            m.rows = Rows::fromSorted(std::make_move_iterator(built.begin()), built.size());
+            m.indexColumns();
+            return m;
+        }
+
+        void checkProduct(const std::vector<T>& x, const std::vector<T>& y, size_t size) const {
+            if (_layout == TREES)
+                throw std::logic_error("products need a frozen matrix");
+            if (!(defaultValue == T()))
+                throw std::logic_error("products need a zero default value");
+            if (x.size() != size)
+                throw std::invalid_argument("vector size does not match the matrix");
+            if (&x == &y)
+                throw std::invalid_argument("product would overwrite its operand");
+        }
+
+        // splits lines into parts of about as much work each, at most one part per thread.
+        // work[i] is the work of the lines before line i, and every line counts as one
+        // more, so that empty lines are not free
+        template <typename Work>
+        static std::vector<size_t> partition(const Work& work, unsigned int threads) {
+            const size_t lines = work.size() - 1,
+                         total = work.back() + lines;
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t parts = std::max<size_t>(1, std::min<size_t>(threads, total / ENTRIES_PER_THREAD));
+
+            std::vector<size_t> bounds(parts + 1, lines);
+            bounds[0] = 0;
+            for (size_t k = 1; k < parts; k++) {
+                // first line at which the work done reaches k parts of it
+                size_t target = total / parts * k,
+                       lo = bounds[k - 1], 
+                       hi = lines;
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (work[mid] + mid < target)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                bounds[k] = lo;
+            }
+            return bounds;
+        }
+
+        // runs job(part, first, last) for every part, the last one on the calling thread
+        template <typename Job>
+        static void runParts(const std::vector<size_t>& bounds, Job job) {
+            std::vector<std::thread> workers;
+            for (size_t k = 0; k + 2 < bounds.size(); k++)
+                workers.emplace_back(job, k, bounds[k], bounds[k + 1]);
+            job(bounds.size() - 2, bounds[bounds.size() - 2], bounds.back());
+            for (std::thread& w : workers)
+                w.join();
+        }
+
+        // sorts in a part per thread, then merges neighbouring parts in rounds
+        template <typename It, typename Compare>
+        static void parallelSort(It first, It last, Compare less, unsigned int threads) {
+            const size_t n = static_cast<size_t>(last - first);
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t parts = std::max<size_t>(1, std::min<size_t>(threads, n / ENTRIES_PER_THREAD));
+
+            std::vector<size_t> bounds(parts + 1);
+            for (size_t k = 0; k <= parts; k++)
+                bounds[k] = n / parts * k;
+            bounds.back() = n;
+
+            // stable throughout, so that equal elements keep their order
+            runParts(bounds, [first, less](size_t, size_t from, size_t to) {
+                std::stable_sort(first + from, first + to, less);
+            });
+            while (bounds.size() > 2) {
+                std::vector<size_t> merged;
+                for (size_t k = 0; k < bounds.size(); k += 2)
+                    merged.push_back(bounds[k]);
+                if (merged.back() != n)
+                    merged.push_back(n);
+
+                runParts(merged, [first, less, &bounds](size_t part, size_t from, size_t to) {
+                    size_t middle = bounds[2 * part + 1];
+                    if (middle < to)
+                        std::inplace_merge(first + from, first + middle, first + to, less);
+                });
+                bounds.swap(merged);
+            }
+        }
+
+        // y[line] = line . x for every line; each line is read once and written once
+        void gather(const T* x, T* y, unsigned int threads) const {
+            const size_t* o = offsets.data();
+            const size_t* ind = indices.data();
+            const T* val = values.data();
+            runParts(partition(offsets, threads), [o, ind, val, x, y](size_t, size_t first, size_t last) {
+                for (size_t line = first; line < last; line++)
+                    y[line] = dot(ind + o[line], val + o[line], o[line + 1] - o[line], x);
+            });
+        }
+
+        // y += x[line] * line for every line. lines of different parts may add to the same
+        // element, so each part adds into its own vector, and these are summed after
+        void scatter(const T* x, T* y, size_t size, unsigned int threads) const {
+            std::vector<size_t> bounds = partition(offsets, threads);
+            std::vector<std::vector<T>> partials(bounds.size() - 2, std::vector<T>(size, T()));
+
+            const size_t* o = offsets.data();
+            const size_t* ind = indices.data();
+            const T* val = values.data();
+            runParts(bounds, [o, ind, val, x, y, &partials](size_t part, size_t first, size_t last) {
+                T* out = part < partials.size() ? partials[part].data() : y;
+                for (size_t line = first; line < last; line++) {
+                    const T factor = x[line];
+                    for (size_t i = o[line]; i < o[line + 1]; i++)
+                        out[ind[i]] += val[i] * factor;
+                }
+            });
+
+            if (partials.empty())
+                return;
+            std::vector<size_t> ranges(bounds.size());
+            for (size_t k = 0; k < ranges.size(); k++)
+                ranges[k] = size / (ranges.size() - 1) * k;
+            ranges.back() = size;
+            runParts(ranges, [y, &partials](size_t, size_t first, size_t last) {
+                for (const std::vector<T>& partial : partials) {
+                    for (size_t i = first; i < last; i++)
+                        y[i] += partial[i];
+                }
+            });
+        }
+
+        template <typename U>
+        static U dot(const size_t* index, const U* value, size_t n, const U* x) {
+            U sum = U();
+            for (size_t i = 0; i < n; i++)
+                sum += value[i] * x[index[i]];
+            return sum;
+        }
+
+#ifdef SPARSEMATRIX_AVX2
+        static double dot(const size_t* index, const double* value, size_t n, const double* x) {
+            // two accumulators, so that consecutive adds do not wait on each other
+            __m256d a = _mm256_setzero_pd(), 
+                    b = _mm256_setzero_pd();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m256d xa = _mm256_i64gather_pd(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i)), 8);
+                __m256d xb = _mm256_i64gather_pd(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i + 4)), 8);
+                a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(value + i), xa));
+                b = _mm256_add_pd(b, _mm256_mul_pd(_mm256_loadu_pd(value + i + 4), xb));
+            }
+            if (i + 4 <= n) {
+                __m256d xa = _mm256_i64gather_pd(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i)), 8);
+                a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(value + i), xa));
+                i += 4;
+            }
+            a = _mm256_add_pd(a, b);
+            __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+            sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+
+            double result = _mm_cvtsd_f64(sum);
+            for (; i < n; i++)
+                result += value[i] * x[index[i]];
+            return result;
+        }
+
+        static float dot(const size_t* index, const float* value, size_t n, const float* x) {
+            // 64 bit indices gather 4 floats at a time
+            __m128 a = _mm_setzero_ps(), 
+                   b = _mm_setzero_ps();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m128 xa = _mm256_i64gather_ps(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i)), 4);
+                __m128 xb = _mm256_i64gather_ps(x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i + 4)), 4);
+                a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(value + i), xa));
+                b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(value + i + 4), xb));
+            }
+            a = _mm_add_ps(a, b);
+            a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+            a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+
+            float result = _mm_cvtss_f32(a);
+            for (; i < n; i++)
+                result += value[i] * x[index[i]];
+            return result;
+        }
+#endif
+
+        /* Accumulates the products of one output row, in a dense array over all the
+           columns when they are few, or else in a hash table sized for the row. a column
+           belongs to the row when its tag is the row's */
+        class Accumulator {
+            protected:
+                static constexpr size_t NONE = static_cast<size_t>(-1);
+
+                bool dense;
+                size_t row, mask;
+                std::vector<size_t> tags;   // dense: row of each column, hashed: column of each slot
+                std::vector<T> sums;
+                std::vector<size_t> columns;
+
+            public:
+                Accumulator(size_t width) : dense(width <= DENSE_COLUMNS), row(NONE), mask(0) {
+                    if (dense) {
+                        tags.assign(width, NONE);
+                        sums.resize(width);
+                    }
+                }
+
+                // starts a row of at most products distinct columns
+                void start(size_t r, size_t products) {
+                    row = r;
+                    columns.clear();
+                    if (dense)
+                        return;
+
+                    size_t slots = 16;
+                    while (slots < 2 * products)
+                        slots *= 2;
+                    mask = slots - 1;
+                    tags.assign(slots, NONE);
+                    sums.resize(slots);
+                }
+
+                void add(size_t column, const T& value) {
+                    if (dense) {
+                        if (tags[column] != row) {
+                            tags[column] = row;
+                            sums[column] = value;
+                            columns.push_back(column);
+                        }
+                        else
+                            sums[column] += value;
+                        return;
+                    }
+
+                    size_t slot = static_cast<size_t>(column * 0x9E3779B97F4A7C15ULL) & mask;
+                    while (tags[slot] != NONE && tags[slot] != column)
+                        slot = (slot + 1) & mask;
+                    if (tags[slot] == NONE) {
+                        tags[slot] = column;
+                        sums[slot] = value;
+                        columns.push_back(slot);
+                    }
+                    else
+                        sums[slot] += value;
+                }
+
+                size_t size() const {
+                    return columns.size();
+                }
+
+                // writes the row in ascending columns, skipping sums which cancelled out,
+                // and returns how many it wrote
+                size_t drain(size_t* index, T* value) {
+                    if (dense)
+                        std::sort(columns.begin(), columns.end());
+                    else {
+                        std::sort(columns.begin(), columns.end(), [this](size_t a, size_t b) {
+                            return tags[a] < tags[b];
+                        });
+                    }
+
+                    size_t n = 0;
+                    for (size_t c : columns) {
+                        if (sums[c] == T())
+                            continue;
+                        index[n] = dense ? c : tags[c];
+                        value[n++] = sums[c];
+                    }
+                    return n;
+                }
+        };
+
         
+        // blank is the default value as printed, followed by a space
         static std::ostream& printDefaultUntil(std::ostream& os, 
                                                const SparseMatrix<T>& m, 
+                                               const std::string& blank,
                                                size_t xs, size_t ys, 
                                                size_t x, size_t y) {
             while (ys < y) {
                 while (xs < m._width) {
-                    os << m.defaultValue << " ";
+                    os << blank;
                     xs++;
                 }
                 ys++;
@@ -35,7 +686,7 @@ class SparseMatrix {
                 os << std::endl;
             }
             while (xs < x) {
-                os << m.defaultValue << " ";
+                os << blank;
                 xs++;
             }
 
@@ -52,32 +703,35 @@ class SparseMatrix {
                 Cell(SparseMatrix& matrix, size_t x, size_t y) : matrix(matrix), x(x), y(y) {};
 
                 T& operator=(const T& data) {
+                    matrix.checkMutable();
                     if (data == matrix.defaultValue) {
-                        matrix.rows[y].remove(x);
-                        if (matrix.rows[y].empty())
-                            matrix.rows.remove(y);
+                        matrix.erase(y, x);
                         return matrix.defaultValue;
                     }
 
-                    T& val = matrix.rows[y][x];
-                    val = data;
-                    return val;
+                    // a cell already there is in its column, and only takes the value
+                    Cols& row = matrix.rows[y];
+                    T* val = row.find(x);
+                    if (val != nullptr)
+                        return *val = data;
+
+                    val = &row[x];
+                    *val = data;
+                    matrix.columns[x].insert(y, val);
+                    return *val;
                 }
 
                 const T& operator*() const {
-                    if (!matrix.rows.containsKey(y))
-                        return matrix.defaultValue;
-                    if (!matrix.rows.at(y).containsKey(x))
-                        return matrix.defaultValue;
-                    return matrix.rows.at(y).at(x);
+                    return matrix.at(y, x);
                 }
 
                 T& operator*() {
-                    if (!matrix.rows.containsKey(y))
-                        return matrix.defaultValue;
-                    if (!matrix.rows[y].containsKey(x))
-                        return matrix.defaultValue;
-                    return matrix.rows[y][x];
+                    if (matrix._layout != TREES) {
+                        size_t i = matrix.entryOf(y, x);
+                        return i == matrix.values.size() ? matrix.defaultValue : matrix.values[i];
+                    }
+                    T* val = matrix.cellOf(y, x);
+                    return val != nullptr ? *val : matrix.defaultValue;
                 }
 
                 friend std::ostream& operator<<(std::ostream& os, const Cell& c) {
@@ -102,18 +756,748 @@ class SparseMatrix {
                 };
         };
 
-        SparseMatrix(const T& defaultValue, size_t w, size_t h) : defaultValue(defaultValue), _width(w), _height(h) {};
+        /* Reads cells as at does, but keeps the row it read last and its place in it, so
+           that reading a row from left to right takes amortized O(1) per cell, and a new
+           row one descent. reading further left seeks the column again, and a CSC matrix
+           is read as at does. it holds on to the trees or arrays of the matrix, so that any
+           write to the matrix leaves it invalid */
+        class RowCursor {
+            protected:
+                const SparseMatrix& matrix;
+                size_t y, x; // the cell read last
+                const Cols* row; // nullptr for a row with no entries
+                typename Cols::const_iterator it, end;
+                const size_t* index; // place in the row of a CSR matrix
+                const size_t* last;  // past the entries of that row
+
+                void seek(size_t y, size_t x) {
+                    this->y = y;
+                    if (matrix._layout == TREES) {
+                        row = matrix.rows.find(y);
+                        if (row != nullptr) {
+                            it = row->lowerBound(x);
+                            end = row->cend();
+                        }
+                    }
+                    else if (matrix._layout == CSR && y + 1 < matrix.offsets.size()) {
+                        last = matrix.indices.data() + matrix.offsets[y + 1];
+                        index = std::lower_bound(matrix.indices.data() + matrix.offsets[y], last, x);
+                    }
+                    else
+                        index = last = nullptr;
+                }
+
+            public:
+                RowCursor(const SparseMatrix& matrix)
+                    : matrix(matrix), y(std::numeric_limits<size_t>::max()), x(0), row(nullptr),
+                      index(nullptr), last(nullptr) {};
+
+                const T& at(size_t y, size_t x) {
+                    if (y != this->y || x < this->x)
+                        seek(y, x);
+                    this->x = x;
+
+                    if (matrix._layout == TREES) {
+                        if (row == nullptr)
+                            return matrix.defaultValue;
+                        while (it != end && it->first < x)
+                            ++it;
+                        return it != end && it->first == x ? *it->second : matrix.defaultValue;
+                    }
+                    if (matrix._layout == CSC)
+                        return matrix.at(y, x);
+
+                    while (index != last && *index < x)
+                        index++;
+                    return index != last && *index == x ? matrix.values[static_cast<size_t>(index - matrix.indices.data())] : matrix.defaultValue;
+                }
+        };
+
+        // the entries of one row of a CSR matrix, or one column of a CSC matrix
+        class Line {
+            protected:
+                const size_t* _indices;
+                const T* _values;
+                size_t _size;
+
+            public:
+                class const_iterator {
+                    protected:
+                        const size_t* index;
+                        const T* value;
+
+                    public:
+                        const_iterator(const size_t* index, const T* value) : index(index), value(value) {};
+
+                        Entry operator*() const {
+                            return Entry{*index, *value};
+                        }
+
+                        const_iterator& operator++() {
+                            index++;
+                            value++;
+                            return *this;
+                        }
+
+                        bool operator==(const const_iterator& other) const {
+                            return index == other.index;
+                        }
+
+                        bool operator!=(const const_iterator& other) const {
+                            return index != other.index;
+                        }
+                };
+
+                Line(const size_t* indices, const T* values, size_t size)
+                    : _indices(indices), _values(values), _size(size) {};
+
+                const_iterator begin() const {
+                    return const_iterator(_indices, _values);
+                }
+
+                const_iterator end() const {
+                    return const_iterator(_indices + _size, _values + _size);
+                }
+
+                size_t size() const {
+                    return _size;
+                }
+
+                const size_t* indices() const {
+                    return _indices;
+                }
+
+                const T* values() const {
+                    return _values;
+                }
+        };
+
+        // entries below which a product part is not worth a thread of its own
+        static constexpr size_t ENTRIES_PER_THREAD = 1 << 15;
+
+        static constexpr uint64_t MAGIC = 0x5253435854414D53ULL;
+        static constexpr uint32_t VERSION = 2;
+
+        // arrays of binary files start at multiples of it, so that they can be used mapped
+        static constexpr size_t ALIGNMENT = 64;
+
+        // bytes of a Matrix Market file below which a chunk is not worth a thread of its own
+        static constexpr size_t MARKET_CHUNK_BYTES = 1 << 20;
+
+        // the entries of one row or column of a matrix in trees, out of its store
+        template <typename Store>
+        class TreeLine {
+            protected:
+                const Store* store; // nullptr for a line with no entries
+
+            public:
+                class const_iterator {
+                    protected:
+                        typename Store::const_iterator it;
+
+                    public:
+                        const_iterator(const typename Store::const_iterator& it) : it(it) {};
 
+                        Entry operator*() const {
+                            return Entry{it->first, valueOf(*it->second)};
+                        }
+
+                        const_iterator& operator++() {
+                            ++it;
+                            return *this;
+                        }
+
+                        bool operator==(const const_iterator& other) const {
+                            return it == other.it;
+                        }
+
+                        bool operator!=(const const_iterator& other) const {
+                            return it != other.it;
+                        }
+                };
+
+                TreeLine(const Store* store) : store(store) {};
+
+                const_iterator begin() const {
+                    return store != nullptr ? const_iterator(store->cbegin()) : const_iterator(typename Store::const_iterator());
+                }
+
+                const_iterator end() const {
+                    return store != nullptr ? const_iterator(store->cend()) : const_iterator(typename Store::const_iterator());
+                }
+
+                bool empty() const {
+                    return store == nullptr;
+                }
+        };
+
+        typedef TreeLine<Cols> RowEntries;
+        typedef TreeLine<ColRows> ColEntries;
+
+        // widest right operand of a product accumulated densely, rather than hashed
+        static constexpr size_t DENSE_COLUMNS = 1 << 18;
+
+        SparseMatrix(const T& defaultValue, size_t w, size_t h) 
+            : defaultValue(defaultValue), _width(w), _height(h), _layout(TREES) {};
+
+        // stores share their values when copied, so the copy rebuilds its own rows
+        SparseMatrix(const SparseMatrix& other)
+            : defaultValue(other.defaultValue), _width(other._width), _height(other._height), _layout(other._layout),
+              offsets(other.offsets), indices(other.indices), values(other.values), mapping(other.mapping) {
+            std::vector<std::pair<size_t, Cols>> built;
+            std::vector<std::pair<size_t, T>> cells;
+            for (auto r = other.rows.cbegin(), rEnd = other.rows.cend(); r != rEnd; ++r) {
+                cells.clear();
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                    cells.emplace_back(c->first, *c->second);
+                built.emplace_back(r->first, Cols::fromSorted(cells.cbegin(), cells.size()));
+            }
+            rows = Rows::fromSorted(std::make_move_iterator(built.begin()), built.size());
+            if (_layout == TREES)
+                indexColumns();
+        }
+
+        SparseMatrix(SparseMatrix&& other) = default;
+
+        SparseMatrix& operator=(SparseMatrix other) {
+            std::swap(defaultValue, other.defaultValue);
+            std::swap(_width, other._width);
+            std::swap(_height, other._height);
+            std::swap(rows, other.rows);
+            std::swap(columns, other.columns);
+            std::swap(_layout, other._layout);
+            std::swap(offsets, other.offsets);
+            std::swap(indices, other.indices);
+            std::swap(values, other.values);
+            std::swap(mapping, other.mapping);
+            return *this;
+        }
+
+        /* Builds a matrix out of (row, col, value) triplets in any order, without a
+           lookup per cell. the triplets are sorted in parallel, those on the same cell are
+           folded with combine(value, next) in their input order, and the matrix is then
+           built from the sorted cells in O(entries): balanced trees, or straight into the
+           arrays of a frozen layout */
+        template <typename InputIt, typename Combine>
+        static SparseMatrix fromTriplets(const T& defaultValue, size_t w, size_t h, 
+                                         InputIt first, InputIt last, Combine combine, 
+                                         Layout layout = TREES, unsigned int threads = 0) {
+            return fromCells(std::vector<Triplet>(first, last), defaultValue, w, h, combine, layout, threads);
+        }
+
+        // packs the trees into compressed arrays by rows (CSR) or columns (CSC)
+        void freeze(Layout layout = CSR) {
+            if (layout == TREES) {
+                thaw();
+                return;
+            }
+            if (_layout == layout)
+                return;
+            if (_layout != TREES)
+                thaw();
+
+            size_t lines = layout == CSR ? _height : _width;
+            std::vector<size_t> o(lines + 1, 0);
+            std::vector<size_t> ind;
+            std::vector<T> val;
+
+            // the trees hold rows in order, so CSR is a single pass, and CSC counts the
+            // entries per column before placing them
+            for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c) {
+                    if (layout == CSR) {
+                        ind.push_back(c->first);
+                        val.push_back(*c->second);
+                        o[r->first + 1]++;
+                    }
+                    else
+                        o[c->first + 1]++;
+                }
+            }
+            for (size_t i = 0; i < lines; i++)
+                o[i + 1] += o[i];
+
+            if (layout == CSC) {
+                ind.resize(o[lines]);
+                val.resize(o[lines], defaultValue);
+                std::vector<size_t> next(o.begin(), o.end() - 1);
+                for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                    for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c) {
+                        size_t i = next[c->first]++;
+                        ind[i] = r->first;
+                        val[i] = *c->second;
+                    }
+                }
+            }
+
+            offsets = Array<size_t>(std::move(o));
+            indices = Array<size_t>(std::move(ind));
+            values = Array<T>(std::move(val));
+            rows = Rows();
+            columns = Columns();
+            _layout = layout;
+        }
+
+        // puts a frozen matrix back into trees
+        void thaw() {
+            if (_layout == TREES)
+                return;
+
+            Rows r;
+            for (size_t line = 0; line + 1 < offsets.size(); line++) {
+                for (size_t i = offsets[line]; i < offsets[line + 1]; i++) {
+                    if (_layout == CSR)
+                        r[line].insert(indices[i], values[i]);
+                    else
+                        r[indices[i]].insert(line, values[i]);
+                }
+            }
+
+            rows = std::move(r);
+            offsets = Array<size_t>();
+            indices = Array<size_t>();
+            values = Array<T>();
+            mapping.reset();
+            _layout = TREES;
+            indexColumns();
+        }
+
+        Layout layout() const {
+            return _layout;
+        }
+
+        // entries of row y of a matrix in trees, in ascending columns
+        RowEntries rowEntries(size_t y) const {
+            if (_layout != TREES)
+                throw std::logic_error("entries need a matrix in trees, frozen ones have row and col");
+            if (y >= _height)
+                throw std::invalid_argument("invalid matrix coordinates");
+            return RowEntries(rows.find(y));
+        }
+
+        // entries of column x of a matrix in trees, in ascending rows
+        ColEntries colEntries(size_t x) const {
+            if (_layout != TREES)
+                throw std::logic_error("entries need a matrix in trees, frozen ones have row and col");
+            if (x >= _width)
+                throw std::invalid_argument("invalid matrix coordinates");
+            return ColEntries(columns.find(x));
+        }
+
+        // A^T, in the same layout for trees (built off the columns, in O(entries)), and
+        // with the arrays as they are otherwise, CSR of A being CSC of A^T
+        SparseMatrix transposed() const {
+            SparseMatrix t(defaultValue, _height, _width);
+            if (_layout != TREES) {
+                t._layout = _layout == CSR ? CSC : CSR;
+                t.offsets = offsets;
+                t.indices = indices;
+                t.values = values;
+                t.mapping = mapping;
+                return t;
+            }
+
+            std::vector<std::pair<size_t, Cols>> built;
+            std::vector<std::pair<size_t, T>> cells;
+            for (auto c = columns.cbegin(), cEnd = columns.cend(); c != cEnd; ++c) {
+                cells.clear();
+                for (auto r = c->second->cbegin(), rEnd = c->second->cend(); r != rEnd; ++r)
+                    cells.emplace_back(r->first, **r->second);
+                built.emplace_back(c->first, Cols::fromSorted(cells.cbegin(), cells.size()));
+            }
+            t.rows = Rows::fromSorted(std::make_move_iterator(built.begin()), built.size());
+            t.indexColumns();
+            return t;
+        }
+
+        // entries of row y, in ascending columns; the matrix must be frozen as CSR
+        Line row(size_t y) const {
+            if (_layout != CSR)
+                throw std::logic_error("rows need a CSR matrix");
+            if (y >= _height)
+                throw std::invalid_argument("invalid matrix coordinates");
+            return Line(indices.data() + offsets[y], values.data() + offsets[y], offsets[y + 1] - offsets[y]);
+        }
+
+        // entries of column x, in ascending rows; the matrix must be frozen as CSC
+        Line col(size_t x) const {
+            if (_layout != CSC)
+                throw std::logic_error("columns need a CSC matrix");
+            if (x >= _width)
+                throw std::invalid_argument("invalid matrix coordinates");
+            return Line(indices.data() + offsets[x], values.data() + offsets[x], offsets[x + 1] - offsets[x]);
+        }
+
+        // y = A x. rows are spread over threads by their entries (threads = 0 takes one
+        // per core); a CSR matrix reads each row once, a CSC one adds each column into y
+        void multiply(const std::vector<T>& x, std::vector<T>& y, unsigned int threads = 0) const {
+            checkProduct(x, y, _width);
+            y.assign(_height, T());
+            if (_layout == CSR)
+                gather(x.data(), y.data(), threads);
+            else
+                scatter(x.data(), y.data(), _height, threads);
+        }
+
+        // y = A^T x, the columns of a CSC matrix taking the place of rows
+        void multiplyTransposed(const std::vector<T>& x, std::vector<T>& y, unsigned int threads = 0) const {
+            checkProduct(x, y, _height);
+            y.assign(_width, T());
+            if (_layout == CSC)
+                gather(x.data(), y.data(), threads);
+            else
+                scatter(x.data(), y.data(), _width, threads);
+        }
+
+        /* C = A B for CSR matrices, into a CSR matrix (Gustavson). rows of C are spread
+           over threads by the products they take. a symbolic pass counts the columns of
+           every row of C, so that the arrays are allocated once, and a numeric pass then
+           fills each row in place */
+        SparseMatrix product(const SparseMatrix& b, unsigned int threads = 0) const {
+            if (_layout != CSR || b._layout != CSR)
+                throw std::logic_error("products need CSR matrices");
+            if (!(defaultValue == T()) || !(b.defaultValue == T()))
+                throw std::logic_error("products need a zero default value");
+            if (_width != b._height)
+                throw std::invalid_argument("matrix sizes do not match");
+
+            // products before every row of C
+            std::vector<size_t> work(_height + 1, 0);
+            for (size_t y = 0; y < _height; y++) {
+                work[y + 1] = work[y];
+                for (size_t i = offsets[y]; i < offsets[y + 1]; i++)
+                    work[y + 1] += b.offsets[indices[i] + 1] - b.offsets[indices[i]];
+            }
+
+            std::vector<size_t> co(_height + 1, 0);
+            std::vector<size_t> ci;
+            std::vector<T> cv;
+            std::vector<size_t> bounds = partition(work, threads);
+
+            // accumulates row y of C
+            const size_t* ao = offsets.data();
+            const size_t* ai = indices.data();
+            const T* av = values.data();
+            const size_t* bo = b.offsets.data();
+            const size_t* bi = b.indices.data();
+            const T* bv = b.values.data();
+            auto accumulate = [ao, ai, av, bo, bi, bv, &work](Accumulator& acc, size_t y, bool numeric) {
+                acc.start(y, work[y + 1] - work[y]);
+                for (size_t i = ao[y]; i < ao[y + 1]; i++) {
+                    const size_t k = ai[i];
+                    const T& factor = av[i];
+                    for (size_t j = bo[k]; j < bo[k + 1]; j++)
+                        acc.add(bi[j], numeric ? factor * bv[j] : T());
+                }
+            };
+
+            runParts(bounds, [&co, &b, &accumulate](size_t, size_t first, size_t last) {
+                Accumulator acc(b._width);
+                for (size_t y = first; y < last; y++) {
+                    accumulate(acc, y, false);
+                    co[y + 1] = acc.size();
+                }
+            });
+            for (size_t y = 0; y < _height; y++)
+                co[y + 1] += co[y];
+
+            ci.resize(co.back());
+            cv.resize(co.back());
+            std::vector<size_t> written(_height);
+            runParts(bounds, [&co, &ci, &cv, &b, &accumulate, &written](size_t, size_t first, size_t last) {
+                Accumulator acc(b._width);
+                for (size_t y = first; y < last; y++) {
+                    accumulate(acc, y, true);
+                    written[y] = acc.drain(ci.data() + co[y], cv.data() + co[y]);
+                }
+            });
+
+            // close the gaps left by sums which cancelled out
+            size_t n = 0;
+            for (size_t y = 0; y < _height; y++) {
+                size_t first = co[y];
+                co[y] = n;
+                if (n != first) {
+                    std::move(ci.begin() + first, ci.begin() + first + written[y], ci.begin() + n);
+                    std::move(cv.begin() + first, cv.begin() + first + written[y], cv.begin() + n);
+                }
+                n += written[y];
+            }
+            co[_height] = n;
+            ci.resize(n);
+            cv.resize(n);
+
+            SparseMatrix c(T(), b._width, _height);
+            c._layout = CSR;
+            c.offsets = Array<size_t>(std::move(co));
+            c.indices = Array<size_t>(std::move(ci));
+            c.values = Array<T>(std::move(cv));
+            return c;
+        }
+
+        SparseMatrix operator*(const SparseMatrix& b) const {
+            return product(b);
+        }
+
+        // writes a frozen matrix next to path, then swaps it in
+        void save(const std::string& path) const {
+            static_assert(std::is_trivially_copyable<T>::value, "saved values must be trivially copyable");
+            if (_layout == TREES)
+                throw std::logic_error("saving needs a frozen matrix");
+
+            BinaryHeader header;
+            header.layout = _layout;
+            header.width = _width;
+            header.height = _height;
+            header.entries = values.size();
+
+            const size_t lines = offsets.size() - 1;
+            header.arraysChecksum = arraysChecksum(defaultValue, offsets.data(), lines, indices.data(), values.data(), values.size());
+            header.checksum = header.compute();
+            size_t at[5];
+            binaryLayout(lines, values.size(), at);
+
+            const std::string tmpPath = path + ".tmp";
+            {
+                File file(tmpPath, O_RDWR | O_CREAT | O_TRUNC);
+                file.write(0, header, sizeof(BinaryHeader));
+                file.write(at[0], reinterpret_cast<const char*>(&defaultValue), sizeof(T));
+                file.write(at[1], reinterpret_cast<const char*>(offsets.data()), (lines + 1) * sizeof(size_t));
+                file.write(at[2], reinterpret_cast<const char*>(indices.data()), values.size() * sizeof(size_t));
+                file.write(at[3], reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+                file.truncate(at[4]);
+                file.sync();
+            }
+
+            if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("could not replace " + path + ": " + std::strerror(errno));
+        }
+
+        // a frozen matrix over the arrays of the file at path, as save wrote them. the
+        // mapping is private, so writes through cells never reach the file. the offsets
+        // and indices are checked, so that reads stay inside the arrays; verify also
+        // checks the checksum of every array, at the cost of reading the whole file
+        static SparseMatrix map(const std::string& path, bool verify = false) {
+            static_assert(std::is_trivially_copyable<T>::value, "mapped values must be trivially copyable");
+            File file(path, O_RDONLY);
+            BinaryHeader header;
+            if (file.read(0, header, sizeof(BinaryHeader)) < sizeof(BinaryHeader) || header.magic != MAGIC)
+                throw std::runtime_error(path + " is not a sparse matrix");
+            if (header.version != VERSION)
+                throw std::runtime_error(path + " has unsupported format version " + std::to_string(header.version));
+            if (header.checksum != header.compute() || (header.layout != CSR && header.layout != CSC))
+                throw std::runtime_error("corrupt header in " + path);
+            if (header.valueSize != sizeof(T))
+                throw std::runtime_error(path + " holds values of another type");
+
+            const size_t size = file.size(),
+                         lines = header.layout == CSR ? header.height : header.width;
+            if (lines >= size / sizeof(size_t) || header.entries > size / sizeof(size_t))
+                throw std::runtime_error(path + " is truncated");
+            size_t at[5];
+            binaryLayout(lines, header.entries, at);
+            if (size < at[4])
+                throw std::runtime_error(path + " is truncated");
+
+            SparseMatrix m(T(), header.width, header.height);
+            m.mapping = std::make_shared<Mapping>(file, at[4], false);
+            const char* base = m.mapping->get();
+            std::memcpy(&m.defaultValue, base + at[0], sizeof(T));
+            m.offsets = Array<size_t>(reinterpret_cast<const size_t*>(base + at[1]), lines + 1);
+            m.indices = Array<size_t>(reinterpret_cast<const size_t*>(base + at[2]), header.entries);
+            m.values = Array<T>(reinterpret_cast<const T*>(base + at[3]), header.entries);
+            if (verify && arraysChecksum(m.defaultValue, m.offsets.data(), lines, m.indices.data(),
+                                         m.values.data(), header.entries) != header.arraysChecksum)
+                throw std::runtime_error("corrupt arrays in " + path);
+
+            const size_t bound = header.layout == CSR ? header.width : header.height;
+            if (m.offsets[0] != 0 || m.offsets[lines] != header.entries)
+                throw std::runtime_error("corrupt offsets in " + path);
+            for (size_t line = 0; line < lines; line++) {
+                size_t first = m.offsets[line], last = m.offsets[line + 1];
+                if (first > last || last > header.entries)
+                    throw std::runtime_error("corrupt offsets in " + path);
+                for (size_t i = first; i < last; i++) {
+                    if (m.indices[i] >= bound || (i > first && m.indices[i] <= m.indices[i - 1]))
+                        throw std::runtime_error("corrupt indices in " + path);
+                }
+            }
+
+            m._layout = static_cast<Layout>(header.layout);
+            return m;
+        }
+
+        /* Reads a Matrix Market coordinate file (real, integer or pattern, and general,
+           symmetric or skew-symmetric) into layout. the file is mapped, its entries are
+           parsed on threads in chunks of whole lines, and the matrix is then built as by
+           fromTriplets, repeated entries adding up. the default value is T() */
+        static SparseMatrix readMatrixMarket(const std::string& path, Layout layout = CSR, unsigned int threads = 0) {
+            File file(path, O_RDONLY);
+            const size_t size = file.size();
+            if (size == 0)
+                throw std::runtime_error(path + " is not a matrix market file");
+            Mapping mapping(file, size, false);
+            mapping.advise(Access::SEQUENTIAL);
+            const char* p = mapping.get();
+            const char* end = p + size;
+
+            std::string banner = nextLine(p, end);
+            std::transform(banner.begin(), banner.end(), banner.begin(), [](char c) { 
+                return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); 
+            });
+            std::istringstream words(banner);
+            std::string tag, object, format, field, symmetry;
+            words >> tag >> object >> format >> field >> symmetry;
+            if (tag != "%%matrixmarket" || object != "matrix")
+                throw std::runtime_error(path + " is not a matrix market file");
+            if (format != "coordinate" ||
+                (field != "real" && field != "double" && field != "integer" && field != "pattern") ||
+                (symmetry != "general" && symmetry != "symmetric" && symmetry != "skew-symmetric"))
+                throw std::runtime_error(path + " holds an unsupported " + format + " " + field + " " + symmetry + " matrix");
+            const bool pattern = field == "pattern",
+                       mirrored = symmetry != "general",
+                       skew = symmetry == "skew-symmetric";
+
+            // comments, then the sizes
+            std::string sizes;
+            do {
+                if (p == end)
+                    throw std::runtime_error(path + " is truncated");
+                sizes = nextLine(p, end);
+            } while (sizes.find_first_not_of(" \t") == std::string::npos || sizes[0] == '%');
+            size_t h, w, entries;
+            std::istringstream dimensions(sizes);
+            if (!(dimensions >> h >> w >> entries))
+                throw std::runtime_error("corrupt sizes in " + path);
+
+            // chunks start after line ends
+            const char* body = p;
+            const size_t bodySize = static_cast<size_t>(end - body);
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t parts = std::max<size_t>(1, std::min<size_t>(threads, bodySize / MARKET_CHUNK_BYTES));
+            std::vector<size_t> bounds(parts + 1, bodySize);
+            bounds[0] = 0;
+            for (size_t k = 1; k < parts; k++) {
+                const char* at = body + std::max(bounds[k - 1], bodySize / parts * k);
+                const char* eol = static_cast<const char*>(std::memchr(at, '\n', end - at));
+                bounds[k] = eol == nullptr ? bodySize : static_cast<size_t>(eol + 1 - body);
+            }
+
+            std::vector<std::vector<Triplet>> parsed(parts);
+            std::vector<size_t> counts(parts, 0);
+            std::vector<std::string> errors(parts);
+            runParts(bounds, [&](size_t part, size_t from, size_t to) {
+                const char* q = body + from;
+                const char* stop = body + to;
+                std::vector<Triplet>& out = parsed[part];
+                out.reserve((to - from) / 8);
+                while (q < stop) {
+                    skipBlanks(q, stop);
+                    if (q < stop && (*q == '\n' || *q == '%')) {
+                        nextLine(q, stop);
+                        continue;
+                    }
+                    if (q == stop)
+                        break;
+
+                    size_t i, j;
+                    T value = T(1);
+                    if (!parseIndex(q, stop, i) || !parseIndex(q, stop, j) || (!pattern && !parseValue(q, stop, value)) ||
+                        i == 0 || j == 0 || i > h || j > w) {
+                        errors[part] = "corrupt entry in " + path;
+                        return;
+                    }
+                    nextLine(q, stop);
+
+                    out.push_back(Triplet{i - 1, j - 1, value});
+                    if (mirrored && i != j)
+                        out.push_back(Triplet{j - 1, i - 1, skew ? T() - value : value});
+                    counts[part]++;
+                }
+            });
+
+            size_t found = 0, total = 0;
+            for (size_t k = 0; k < parts; k++) {
+                if (!errors[k].empty())
+                    throw std::runtime_error(errors[k]);
+                found += counts[k];
+                total += parsed[k].size();
+            }
+            if (found != entries)
+                throw std::runtime_error(path + " holds " + std::to_string(found) + " entries, not " + std::to_string(entries));
+
+            std::vector<Triplet> cells(std::move(parsed[0]));
+            cells.reserve(total);
+            for (size_t k = 1; k < parts; k++) {
+                cells.insert(cells.end(), parsed[k].begin(), parsed[k].end());
+                parsed[k] = std::vector<Triplet>();
+            }
+            return fromCells(std::move(cells), T(), w, h, std::plus<T>(), layout, threads);
+        }
+
+        // writes the entries as a general Matrix Market coordinate file, by rows but for
+        // CSC, which goes by columns. the default value is not written
+        void writeMatrixMarket(const std::string& path) const {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                throw std::runtime_error("could not open " + path);
+
+            out << "%%MatrixMarket matrix coordinate " << (std::is_integral<T>::value ? "integer" : "real") << " general\n";
+            out << _height << " " << _width << " " << nonZeros() << "\n";
+            if (!std::is_integral<T>::value)
+                out << std::setprecision(std::numeric_limits<T>::max_digits10);
+
+            if (_layout == TREES) {
+                for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                    for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                        out << r->first + 1 << ' ' << c->first + 1 << ' ' << *c->second << '\n';
+                }
+            }
+            else {
+                for (size_t line = 0; line + 1 < offsets.size(); line++) {
+                    for (size_t i = offsets[line]; i < offsets[line + 1]; i++) {
+                        size_t y = _layout == CSR ? line : indices[i],
+                               x = _layout == CSR ? indices[i] : line;
+                        out << y + 1 << ' ' << x + 1 << ' ' << values[i] << '\n';
+                    }
+                }
+            }
+
+            out.flush();
+            if (!out)
+                throw std::runtime_error("could not write " + path);
+        }
+
+        // entries differing from the default value
+        size_t nonZeros() const {
+            if (_layout != TREES)
+                return values.size();
+
+            size_t n = 0;
+            for (auto r = rows.cbegin(), rEnd = rows.cend(); r != rEnd; ++r) {
+                for (auto c = r->second->cbegin(), cEnd = r->second->cend(); c != cEnd; ++c)
+                    n++;
+            }
+            return n;
+        }
+
+        // drops the rows and columns left outside, in O(entries in them) by the cross index,
+        // so that neither freeze nor indexColumns index their arrays past the new bounds
         void resize(size_t width, size_t height) {
-            // rows.removeWhere([width] (int k) {
-            //     return k >= width;
-            // });
-
-            // rows.foreach([height] (const Cols& c) {
-            //     c.removeWhere([height] (int k) {
-            //         return k >= height;
-            //     });
-            // });
+            checkMutable();
+            std::vector<size_t> dropped;
+            for (auto r = rows.lowerBound(height), rEnd = rows.cend(); r != rEnd; ++r)
+                dropped.push_back(r->first);
+            for (size_t y : dropped)
+                purgeRow(y);
+
+            dropped.clear();
+            for (auto c = columns.lowerBound(width), cEnd = columns.cend(); c != cEnd; ++c)
+                dropped.push_back(c->first);
+            for (size_t x : dropped)
+                purgeCol(x);
+
             _width = width;
             _height = height;
         }
@@ -124,38 +1508,81 @@ class SparseMatrix {
             return Row(*this, y);
         };
 
+        RowCursor cursor() const {
+            return RowCursor(*this);
+        }
+
         const T& at(size_t y, size_t x) const {
-            if (!rows.containsKey(y))
-                return defaultValue;
-            if (!rows.at(y).containsKey(x))
-                return defaultValue;
-            return rows.at(y).at(x);
+            if (_layout != TREES) {
+                size_t i = entryOf(y, x);
+                return i == values.size() ? defaultValue : values[i];
+            }
+            const T* val = cellOf(y, x);
+            return val != nullptr ? *val : defaultValue;
         }
 
+        // O(entries in the row), each taking a descent into its column
         void purgeRow(size_t y) {
+            checkMutable();
+            const Cols* row = rows.find(y);
+            if (row == nullptr)
+                return;
+
+            for (auto c = row->cbegin(), cEnd = row->cend(); c != cEnd; ++c) {
+                ColRows& col = columns[c->first];
+                col.remove(y);
+                if (col.empty())
+                    columns.remove(c->first);
+            }
             rows.remove(y);
         }
 
+        // O(entries in the column), each taking a descent into its row
         void purgeCol(size_t x) {
-            for (auto& row : rows)
-                row.second->remove(x);
+            checkMutable();
+            const ColRows* col = columns.find(x);
+            if (col == nullptr)
+                return;
+
+            for (auto r = col->cbegin(), rEnd = col->cend(); r != rEnd; ++r) {
+                Cols& row = rows[r->first];
+                row.remove(x);
+                if (row.empty())
+                    rows.remove(r->first);
+            }
+            columns.remove(x);
         }
 
         friend std::ostream& operator<<(std::ostream& os, const SparseMatrix<T>& m) {
             os << "---------------------" << std::endl;
 
+            if (m._layout != TREES) {
+                RowCursor cells = m.cursor();
+                for (size_t y = 0; y < m._height; y++) {
+                    for (size_t x = 0; x < m._width; x++)
+                        os << cells.at(y, x) << " ";
+                    os << std::endl;
+                }
+                os << "---------------------";
+                return os;
+            }
+
+            std::ostringstream printed;
+            printed << m.defaultValue << " ";
+            const std::string blank = printed.str();
+
             size_t lastX = 0,
                    lastY = 0;
             for (auto colPair = m.rows.cbegin(); colPair != m.rows.cend(); colPair++) {
                 for (auto valPair = colPair->second->cbegin(); valPair != colPair->second->cend(); valPair++) {
-                    printDefaultUntil(os, m, lastX, lastY, valPair->first, colPair->first);
+                    printDefaultUntil(os, m, blank, lastX, lastY, valPair->first, colPair->first);
                     os << *valPair->second << " ";
 
                     lastX = valPair->first + 1;
                     lastY = colPair->first;
                 }
             }
-            printDefaultUntil(os, m, lastX, lastY, m._width, m._height - 1);
+            printDefaultUntil(os, m, blank, lastX, lastY, m._width, m._height - 1);
             os << std::endl;
             os << "---------------------";
             return os;
@@ -0,0 +1,154 @@
+#ifndef WRITEAHEADLOG_INCLUDED
+#define WRITEAHEADLOG_INCLUDED
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+#include "FileIO.hpp"
+#include "Checksum.hpp"
+
+/* LOG FORMAT
+   (LogRecordHeader + length)[] records, each a header holding the payload
+                                length and checksum followed by the payload.
+                                payloads are never empty, so a zero length ends the log */
+
+// Append-only redo log. Records are buffered in memory by append and made
+// durable by commit, which lets a single writer sync on behalf of every
+// other writer waiting on it (group commit)
+class WriteAheadLog {
+    public:
+        WriteAheadLog(const std::string& path)
+            : file(path), base(0), end(file.size()), appended(end), durable(end), syncing(false) {}
+
+        WriteAheadLog(const WriteAheadLog& other) = delete;
+        WriteAheadLog& operator=(const WriteAheadLog& other) = delete;
+
+        // buffers a record, returning its log sequence number. sequence numbers keep
+        // growing across truncations, so they can be compared at any time
+        uint64_t append(const char* data, size_t n) {
+            if (n == 0)
+                throw std::invalid_argument("log records cannot be empty");
+
+            LogRecordHeader header;
+            header.length = n;
+            header.checksum = checksum(data, n);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            const char* raw = reinterpret_cast<const char*>(&header);
+            pending.insert(pending.end(), raw, raw + sizeof(LogRecordHeader));
+            pending.insert(pending.end(), data, data + n);
+            appended += sizeof(LogRecordHeader) + n;
+            return appended;
+        }
+
+        // waits until every record up to lsn is on disk. the first waiter writes and
+        // syncs everything appended so far, while later ones wait for it to finish
+        void commit(uint64_t lsn) {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (durable < lsn) {
+                if (syncing) {
+                    synced.wait(lock);
+                    continue;
+                }
+
+                syncing = true;
+                std::vector<char> batch;
+                batch.swap(pending);
+                uint64_t offset = end, upTo = appended;
+                end += batch.size();
+
+                lock.unlock();
+                file.write(offset, batch.data(), batch.size());
+                file.datasync();
+                lock.lock();
+
+                durable = upTo;
+                syncing = false;
+                synced.notify_all();
+            }
+        }
+
+        void commit() {
+            commit(lsn());
+        }
+
+        uint64_t lsn() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return appended;
+        }
+
+        // bytes in the log, including those not written yet
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return appended - base;
+        }
+
+        // calls operation on every intact record, dropping a torn tail left by a crash
+        void replay(std::function<void(const char* data, size_t n)> operation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t offset = 0;
+            std::vector<char> data;
+            while (offset + sizeof(LogRecordHeader) <= end) {
+                LogRecordHeader header;
+                file.read(offset, reinterpret_cast<char*>(&header), sizeof(LogRecordHeader));
+                // a zero filled tail would pass as empty records, whose checksum is 0 as well
+                if (header.length == 0 || offset + sizeof(LogRecordHeader) + header.length > end)
+                    break;
+
+                data.resize(header.length);
+                file.read(offset + sizeof(LogRecordHeader), data.data(), header.length);
+                if (checksum(data.data(), data.size()) != header.checksum)
+                    break;
+
+                operation(data.data(), data.size());
+                offset += sizeof(LogRecordHeader) + header.length;
+            }
+
+            if (offset < end) {
+                file.truncate(offset);
+                end = offset;
+                appended = durable = base + offset;
+            }
+        }
+
+        // empties the log once everything in it is reflected in the data file
+        void truncate() {
+            std::unique_lock<std::mutex> lock(mutex);
+            synced.wait(lock, [this] { return !syncing; });
+
+            pending.clear();
+            file.truncate(0);
+            file.datasync();
+            base = durable = appended;
+            end = 0;
+        }
+
+    private:
+        struct LogRecordHeader {
+            uint32_t length;
+            uint32_t checksum;
+        };
+
+        File file;
+        mutable std::mutex mutex;
+        std::condition_variable synced;
+
+        std::vector<char> pending; // appended records not yet written
+        uint64_t base;             // sequence number of the start of the file
+        uint64_t end;              // bytes written to the file
+        uint64_t appended;         // bytes appended, written or not
+        uint64_t durable;          // bytes known to be on disk
+        bool syncing;
+
+        static uint32_t checksum(const char* data, size_t n) {
+            return CRC32C::compute(data, n);
+        }
+};
+
+#endif
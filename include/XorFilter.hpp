@@ -0,0 +1,197 @@
+#ifndef XORFILTER_INCLUDED
+#define XORFILTER_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "BloomFilter.hpp"
+
+/* Xor filter (Graf and Lemire) over 64 bit hashes, for sets which never change.
+   every hash maps to one slot in each third of the table, and the fingerprints are
+   assigned so that the three slots of a member xor to its fingerprint. it takes
+   about 1.23 slots per key, and fingerprints of 8, 16 or 32 bits, the least
+   reaching the false positive rate (2^-bits)
+
+   FORMAT
+   (uint64_t) seed
+   (uint32_t) slots per third
+   (uint32_t) fingerprint bytes
+   (char)[]   fingerprints */
+class XorFilter {
+    public:
+        static constexpr uint16_t KIND = 2;
+
+        // attempts at a seed for which every key finds a slot of its own
+        static constexpr size_t MAX_ATTEMPTS = 64;
+
+        XorFilter() : seed(0), segment(0), width(1) {}
+
+        XorFilter(const std::vector<uint64_t>& hashes, double falsePositiveRate = 1.0 / 256)
+            : seed(0), width(widthOf(falsePositiveRate)) {
+            std::vector<uint64_t> keys(hashes);
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+            segment = static_cast<uint32_t>((32 + static_cast<size_t>(std::ceil(1.23 * keys.size())) + 2) / 3);
+            const size_t capacity = 3 * static_cast<size_t>(segment);
+
+            // peeling order: a key and the slot only it maps to among those left
+            std::vector<std::pair<uint64_t, uint32_t>> order;
+            std::vector<uint64_t> xors(capacity);
+            std::vector<uint32_t> counts(capacity);
+            std::vector<uint32_t> single;
+
+            for (size_t attempt = 0; ; attempt++) {
+                if (attempt == MAX_ATTEMPTS)
+                    throw std::runtime_error("could not build xor filter");
+                seed = mixHash(attempt + 0x9E3779B97F4A7C15ULL);
+
+                std::fill(xors.begin(), xors.end(), 0);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (uint64_t key : keys) {
+                    uint32_t slots[3];
+                    slotsOf(mixHash(key + seed), slots);
+                    for (uint32_t slot : slots) {
+                        xors[slot] ^= key;
+                        counts[slot]++;
+                    }
+                }
+
+                single.clear();
+                for (size_t slot = 0; slot < capacity; slot++) {
+                    if (counts[slot] == 1)
+                        single.push_back(static_cast<uint32_t>(slot));
+                }
+
+                order.clear();
+                while (!single.empty()) {
+                    uint32_t slot = single.back();
+                    single.pop_back();
+                    if (counts[slot] != 1)
+                        continue;
+
+                    uint64_t key = xors[slot];
+                    order.emplace_back(key, slot);
+                    uint32_t slots[3];
+                    slotsOf(mixHash(key + seed), slots);
+                    for (uint32_t other : slots) {
+                        xors[other] ^= key;
+                        if (--counts[other] == 1)
+                            single.push_back(other);
+                    }
+                }
+                if (order.size() == keys.size())
+                    break;
+            }
+
+            // in reverse peeling order, the slot of each key is the last of its three set
+            fingerprints.assign(capacity * width, 0);
+            for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                uint64_t h = mixHash(it->first + seed);
+                uint32_t slots[3];
+                slotsOf(h, slots);
+                uint32_t value = fingerprintOf(h);
+                for (uint32_t slot : slots) {
+                    if (slot != it->second)
+                        value ^= at(slot);
+                }
+                store(it->second, value);
+            }
+        }
+
+        bool mayContain(uint64_t hash) const {
+            if (fingerprints.empty())
+                return true;
+
+            uint64_t h = mixHash(hash + seed);
+            uint32_t slots[3];
+            slotsOf(h, slots);
+            return fingerprintOf(h) == (at(slots[0]) ^ at(slots[1]) ^ at(slots[2]));
+        }
+
+        size_t bytes() const {
+            return fingerprints.size();
+        }
+
+        void encode(std::vector<char>& out) const {
+            const uint32_t w = width;
+            const char* raw = reinterpret_cast<const char*>(&seed);
+            out.insert(out.end(), raw, raw + sizeof(uint64_t));
+            raw = reinterpret_cast<const char*>(&segment);
+            out.insert(out.end(), raw, raw + sizeof(uint32_t));
+            raw = reinterpret_cast<const char*>(&w);
+            out.insert(out.end(), raw, raw + sizeof(uint32_t));
+            out.insert(out.end(), fingerprints.begin(), fingerprints.end());
+        }
+
+        static const char* decode(const char* in, const char* end, XorFilter& out) {
+            const size_t header = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+            if (end - in < static_cast<ptrdiff_t>(header))
+                throw std::runtime_error("truncated xor filter");
+
+            uint32_t w;
+            std::memcpy(&out.seed, in, sizeof(uint64_t));
+            std::memcpy(&out.segment, in + sizeof(uint64_t), sizeof(uint32_t));
+            std::memcpy(&w, in + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint32_t));
+            in += header;
+            if (w != 1 && w != 2 && w != 4)
+                throw std::runtime_error("corrupt xor filter");
+
+            out.width = w;
+            size_t n = 3 * static_cast<size_t>(out.segment) * w;
+            if (static_cast<size_t>(end - in) < n)
+                throw std::runtime_error("truncated xor filter");
+            out.fingerprints.assign(in, in + n);
+            return in + n;
+        }
+
+    private:
+        uint64_t seed;
+        uint32_t segment; // slots per third of the table
+        unsigned int width;
+        std::vector<char> fingerprints;
+
+        static unsigned int widthOf(double falsePositiveRate) {
+            if (!(falsePositiveRate > 0 && falsePositiveRate < 1))
+                throw std::invalid_argument("false positive rate must lie in (0, 1)");
+            if (falsePositiveRate >= 1.0 / 256)
+                return 1;
+            return falsePositiveRate >= 1.0 / 65536 ? 2 : 4;
+        }
+
+        static uint32_t reduce(uint32_t hash, uint32_t n) {
+            return static_cast<uint32_t>((static_cast<uint64_t>(hash) * n) >> 32);
+        }
+
+        static uint64_t rotate(uint64_t h, unsigned int bits) {
+            return (h << bits) | (h >> (64 - bits));
+        }
+
+        void slotsOf(uint64_t h, uint32_t* slots) const {
+            slots[0] = reduce(static_cast<uint32_t>(h), segment);
+            slots[1] = reduce(static_cast<uint32_t>(rotate(h, 21)), segment) + segment;
+            slots[2] = reduce(static_cast<uint32_t>(rotate(h, 42)), segment) + 2 * segment;
+        }
+
+        uint32_t fingerprintOf(uint64_t h) const {
+            uint64_t f = h ^ (h >> 32);
+            return width == 4 ? static_cast<uint32_t>(f) : static_cast<uint32_t>(f & ((uint32_t(1) << (8 * width)) - 1));
+        }
+
+        uint32_t at(uint32_t slot) const {
+            uint32_t value = 0;
+            std::memcpy(&value, fingerprints.data() + static_cast<size_t>(slot) * width, width); // little endian
+            return value;
+        }
+
+        void store(uint32_t slot, uint32_t value) {
+            std::memcpy(fingerprints.data() + static_cast<size_t>(slot) * width, &value, width);
+        }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstdio>
+
+#include "AVLDatabase.hpp"
+
+using namespace std;
+
+// times n random inserts into a fresh table, then the same inserts into another fresh
+// table while a second thread keeps scanning snapshots of it
+void benchmark(int n) {
+    using namespace std::chrono;
+    if (n <= 0) {
+        cout << "the benchmark needs at least one record" << endl;
+        return;
+    }
+
+    const string idx = "C:/Temp/avl_database_benchmark.idx",
+                 dat = "C:/Temp/avl_database_benchmark.dat";
+    long long scans = 0, scanned = 0;
+
+    auto ingest = [&] (bool scanning) {
+        for (const string& path : { idx, idx + ".log", dat, dat + ".free", dat + ".wal" })
+            std::remove(path.c_str());
+        AVLDatabase<int, long long> d(idx, dat);
+        mt19937 rng(42);
+
+        atomic<bool> stop(false);
+        thread scanner;
+        if (scanning) {
+            scanner = thread([&] {
+                while (!stop) {
+                    auto snapshot = d.snapshot();
+                    snapshot.scan([&scanned] (int, long long) { scanned++; });
+                    scans++;
+                }
+            });
+        }
+
+        auto start = steady_clock::now();
+        for (int i = 0; i < n; i++)
+            d.insert(rng() % n, i);
+        d.flush();
+        long long elapsed = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+        stop = true;
+        if (scanning)
+            scanner.join();
+        return elapsed;
+    };
+
+    long long alone = ingest(false);
+    long long shared = ingest(true);
+
+    cout << "ingest: " << n * 1000000000LL / alone << " records/s" << endl;
+    cout << "ingest while scanning: " << n * 1000000000LL / shared << " records/s ("
+         << scans << " full scans, " << scanned << " records)" << endl;
+}
+
+int main() {
+    AVLDatabase<int, long long> d("C:/Temp/avl_database.idx", "C:/Temp/avl_database.dat");
+    auto& byValue = d.addIndex<long long>("value", [] (long long v) { return v; });
+
+    while (true) {
+        cout << "op (i key value | r key | f key | q from to | c | w | b n | e)" << endl;
+
+        int key;
+        long long value;
+        char op;
+        cin >> op;
+        if (op == 'e')
+            return 0;
+
+        if (op == 'i') {
+            cin >> key >> value;
+            d.insert(key, value);
+        }
+        else if (op == 'r') {
+            cin >> key;
+            if (!d.remove(key))
+                cout << "key not found" << endl;
+        }
+        else if (op == 'f') {
+            cin >> key;
+            if (d.find(key, value))
+                cout << value << endl;
+            else
+                cout << "key not found" << endl;
+        }
+        else if (op == 'q') {
+            long long from, to;
+            cin >> from >> to;
+            d.range(byValue, from, to, [] (int key, long long value) {
+                cout << key << ": " << value << endl;
+            });
+        }
+        else if (op == 'c')
+            d.checkpoint();
+        else if (op == 'w')
+            d.rewrite();
+        else if (op == 'b') {
+            int n;
+            cin >> n;
+            benchmark(n);
+            continue;
+        }
+        else
+            cout << "type in a valid operation" << endl;
+        cout << d << endl;
+        cout << "size " << d.size() << ", height " << d.height()
+             << (d.clean() ? ", clean" : ", dirty") << endl;
+    }
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <cmath>
+#include <malloc.h>
+
+#include "BlockSparseMatrix.hpp"
+
+using namespace std;
+
+// bytes the heap holds, to weigh the trees of a matrix
+size_t heapBytes() {
+    return mallinfo2().uordblks;
+}
+
+// an n x n matrix of about k random dense c x c clusters per block of c rows, against
+// SparseMatrix: heap per nonzero in trees, and products once frozen
+void benchmark(size_t n, size_t k, size_t c) {
+    using namespace std::chrono;
+    typedef SparseMatrix<double> Matrix;
+    typedef BlockSparseMatrix<double, 4> Blocks;
+    mt19937 rng(42);
+
+    vector<Matrix::Triplet> triplets;
+    for (size_t y0 = 0; y0 + c <= n; y0 += c) {
+        for (size_t i = 0; i < k; i++) {
+            size_t x0 = rng() % (n - c + 1);
+            for (size_t y = y0; y < y0 + c; y++) {
+                for (size_t x = x0; x < x0 + c; x++)
+                    triplets.push_back(Matrix::Triplet{y, x, 1 + rng() % 100 / 100.0});
+            }
+        }
+    }
+    auto last = [](double, double b) { return b; };
+
+    size_t before = heapBytes();
+    Matrix a = Matrix::fromTriplets(0, n, n, triplets.begin(), triplets.end(), last);
+    const double entries = static_cast<double>(a.nonZeros());
+    cout << "SparseMatrix trees: " << (heapBytes() - before) / entries << " bytes per nonzero" << endl;
+
+    before = heapBytes();
+    Blocks b = Blocks::fromTriplets(0, n, n, triplets.begin(), triplets.end(), last);
+    cout << "BlockSparseMatrix trees: " << (heapBytes() - before) / entries << " bytes per nonzero, "
+         << entries / (b.tiles() * Blocks::CELLS) << " of the tile cells filled" << endl;
+
+    a.freeze(Matrix::CSR);
+    b.freeze();
+    cout << "CSR: " << (sizeof(double) + sizeof(size_t)) << " bytes per nonzero, BSR: "
+         << b.tiles() * (Blocks::CELLS * sizeof(double) + sizeof(size_t)) / entries << " bytes per nonzero" << endl;
+
+    vector<double> x(n, 1), y, z;
+    const int runs = 10;
+    for (int blocks = 0; blocks < 2; blocks++) {
+        // untimed, as the first allocation after freezing pays for the freed trees
+        blocks ? b.multiply(x, z) : a.multiply(x, y);
+
+        auto start = steady_clock::now();
+        for (int r = 0; r < runs; r++)
+            blocks ? b.multiply(x, z) : a.multiply(x, y);
+        double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9 / runs;
+        cout << (blocks ? "BSR A x: " : "CSR A x: ") << 2 * entries / seconds / 1e9 << " GFLOP/s" << endl;
+    }
+
+    // the tiles add up in another order, so the products match only closely
+    double error = 0;
+    for (size_t i = 0; i < n; i++)
+        error = max(error, abs(y[i] - z[i]) / max(1.0, abs(y[i])));
+    cout << "largest relative difference: " << error << endl;
+}
+
+int main() {
+    BlockSparseMatrix<int, 4> m(0, 10, 10);
+    try {
+        while (true) {
+            string s;
+            cout << "op num | f (freeze) | t (thaw) | l (list tiles) | b n k c | e" << endl;
+
+            int x, y, val;
+            char op;
+            cin >> op;
+            if (op == 'e')
+                return 0;
+
+            if (op == 'b') {
+                size_t n, k, c;
+                cin >> n >> k >> c;
+                benchmark(n, k, c);
+                continue;
+            }
+
+            if (op == 'f' || op == 't') {
+                if (op == 't')
+                    m.thaw();
+                else
+                    m.freeze();
+                cout << m << endl << m.nonZeros() << " nonzeros in " << m.tiles() << " tiles" << endl;
+                continue;
+            }
+
+            if (op == 'l') {
+                m.forEachTile([](size_t by, size_t bx, const int* cells) {
+                    cout << "(" << by << ", " << bx << "):";
+                    for (size_t i = 0; i < BlockSparseMatrix<int, 4>::CELLS; i++)
+                        cout << " " << cells[i];
+                    cout << endl;
+                });
+                continue;
+            }
+
+            cin >> x >> y >> val;
+            if (op == 'i')
+                m[x][y] = val;
+            else if (op == 'a')
+                cout << m[x][y] << endl;
+            else
+                cout << "type in a valid operation" << endl;
+            cout << m << endl;
+        }
+    }
+    catch (const exception& e) {
+        cout << e.what() << endl;
+        cin.get();
+    }
+};
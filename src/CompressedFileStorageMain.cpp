@@ -0,0 +1,70 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+
+#include "CompressedFileStorage.hpp"
+
+using namespace std;
+
+// appends n timestamps a few milliseconds apart, printing how well they compress and how fast they scan
+void benchmark(CompressedFileStorage<long long>& t, int n) {
+    using namespace std::chrono;
+    if (n <= 0) {
+        cout << "the benchmark needs at least one record" << endl;
+        return;
+    }
+
+    long long now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    for (int i = 0; i < n; i++)
+        t.append(now + i * 5 + i % 3);
+    t.flush();
+
+    auto start = steady_clock::now();
+    long long sum = 0;
+    t.scan(0, t.size(), [&sum] (size_t, long long data) { sum += data; });
+    auto scanned = steady_clock::now();
+
+    cout << "stored: " << t.storedBytes() << " bytes for " << t.size() * sizeof(long long) << " raw" << endl;
+    cout << "scan: " << duration_cast<nanoseconds>(scanned - start).count() / t.size() << "ns/record"
+         << " (checksum " << sum << ")" << endl;
+}
+
+int main() {
+    CompressedFileStorage<long long> t("C:/Temp/compressed_file_storage.dat");
+
+    while (true) {
+        cout << "op num index | e" << endl;
+
+        long long num;
+        size_t index;
+        char op;
+        cin >> op;
+        if (op == 'e')
+            return 0;
+
+        cin >> num >> index;
+        if (op == 'w')
+            t.write(num, index);
+        else if (op == 'a')
+            cout << "Index: " << t.append(num) << endl;
+        else if (op == 'f')
+            cout << "Header: " << t.header() << endl;
+        else if (op == 'r')
+            cout << "Read: " << t.read(num) << endl;
+        else if (op == 'd')
+            t.remove(num);
+        else if (op == 's')
+            t.sync();
+        else if (op == 'c')
+            t.compact();
+        else if (op == 'b') {
+            benchmark(t, num);
+            continue;
+        }
+        else
+            cout << "type in a valid operation" << endl;
+        cout << t << endl;
+    }
+
+    return 0;
+}
@@ -1,10 +1,134 @@
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "FileStorage.hpp"
 
 using namespace std;
 
+// times n sequential writes, n reads and a scan, printing the cost per record
+void benchmark(FileStorage<int>& t, int n) {
+    using namespace std::chrono;
+    if (n <= 0) {
+        cout << "the benchmark needs at least one record" << endl;
+        return;
+    }
+
+    auto start = steady_clock::now();
+    for (int i = 0; i < n; i++)
+        t.write(i, i);
+    t.flush();
+    auto written = steady_clock::now();
+
+    long long sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += t.read(i);
+    auto read = steady_clock::now();
+
+    long long scanned = 0;
+    t.scan(0, n, [&scanned] (size_t, int data) { scanned += data; });
+    auto scan = steady_clock::now();
+
+    cout << "write: " << duration_cast<nanoseconds>(written - start).count() / n << "ns/record" << endl;
+    cout << "read: " << duration_cast<nanoseconds>(read - written).count() / n << "ns/record" 
+         << " (checksum " << sum << ")" << endl;
+    cout << "scan: " << duration_cast<nanoseconds>(scan - read).count() / n << "ns/record"
+         << " (checksum " << scanned << ")" << endl;
+}
+
+// kills a writer with SIGKILL at a random moment, trials times, and checks what the
+// next open recovers. the writer stores round r in each of n records, in a shuffled
+// order, commits and only then reports r, so every record must hold the last reported
+// round or the one after it. odd trials also map the file
+void crashTest(int n, int trials) {
+    const string path = "C:/Temp/file_storage_crash.dat";
+    if (n <= 0) {
+        cout << "the crash test needs at least one record" << endl;
+        return;
+    }
+
+    mt19937 rng(42);
+    int failed = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        unsigned int flags = FileStorage<long long>::LOGGED | (trial % 2 ? FileStorage<long long>::MAPPED : FileStorage<long long>::DEFAULT);
+        for (const char* suffix : { "", ".wal", ".free" })
+            std::remove((path + suffix).c_str());
+
+        int fds[2];
+        if (pipe(fds) != 0) {
+            cout << "could not create a pipe" << endl;
+            return;
+        }
+
+        pid_t writer = fork();
+        if (writer < 0) {
+            cout << "could not fork the writer" << endl;
+            return;
+        }
+        if (writer == 0) {
+            close(fds[0]);
+            try {
+                FileStorage<long long> s(path, flags);
+                s.checkpointAfter(1 << 16); // so that crashes also hit checkpoints
+                vector<size_t> order(n);
+                for (size_t i = 0; i < order.size(); i++)
+                    order[i] = i;
+                mt19937 shuffler(trial);
+                for (long long round = 1; ; round++) {
+                    shuffle(order.begin(), order.end(), shuffler);
+                    for (size_t i : order)
+                        s.write(round, i);
+                    s.commit();
+                    if (::write(fds[1], &round, sizeof(round)) != sizeof(round))
+                        _exit(1);
+                }
+            } catch (const exception& e) {
+                cerr << "writer: " << e.what() << endl;
+            }
+            _exit(1);
+        }
+
+        close(fds[1]);
+        usleep(1000 + rng() % 50000);
+        kill(writer, SIGKILL);
+        int status;
+        waitpid(writer, &status, 0);
+
+        long long committed = 0, round;
+        while (read(fds[0], &round, sizeof(round)) == sizeof(round))
+            committed = round;
+        close(fds[0]);
+        if (!WIFSIGNALED(status)) {
+            cout << "trial " << trial << ": the writer failed before the kill" << endl;
+            failed++;
+            continue;
+        }
+
+        try {
+            FileStorage<long long> s(path, flags);
+            s.verify();
+            if (committed > 0 && s.size() < static_cast<size_t>(n))
+                throw runtime_error("only " + to_string(s.size()) + " records recovered");
+            for (size_t i = 0; i < s.size(); i++) {
+                long long data = s.valid(i) ? s.read(i) : 0;
+                if (data < committed || data > committed + 1)
+                    throw runtime_error("record " + to_string(i) + " holds round " + to_string(data));
+            }
+        } catch (const exception& e) {
+            cout << "trial " << trial << " (round " << committed << " committed): " << e.what() << endl;
+            failed++;
+        }
+    }
+    cout << trials - failed << " of " << trials << " crashes recovered" << endl;
+}
+
 int main() {
     FileStorage<int> t("C:/Temp/file_storage.dat");
     
@@ -21,16 +145,47 @@ int main() {
         cin >> num >> index;
         if (op == 'w')
             t.write(num, index);
+        else if (op == 'a')
+            cout << "Index: " << t.append(num) << endl;
+        else if (op == 'i')
+            cout << "Index: " << t.insert(num) << endl;
         else if (op == 'f')
             cout << "Header: " << t.header() << endl;
         else if (op == 'r')
             cout << "Read: " << t.read(num) << endl;
         else if (op == 'd')
             t.remove(num);
+        else if (op == 's')
+            t.sync();
+        else if (op == 'v') {
+            t.verify();
+            cout << "Every page is intact" << endl;
+            continue;
+        }
+        else if (op == 'l') {
+            t.scan(num, index, [] (size_t i, int data) { cout << i << ": " << data << endl; });
+            continue;
+        }
+        else if (op == 'c') {
+            for (const auto& moved : t.compact(num))
+                cout << "Moved: " << moved.first << " -> " << moved.second << endl;
+        }
+        else if (op == 'b') {
+            benchmark(t, num);
+            continue;
+        }
+        else if (op == 'k') {
+            crashTest(num, index);
+            continue;
+        }
+        else if (op == 'p') {
+            cout << "Buffer pool: " << BufferPool::shared().stats() << endl;
+            continue;
+        }
         else
             cout << "type in a valid operation" << endl;
         cout << t << endl;
     }
 
     return 0;
-}
\ No newline at end of file
+}
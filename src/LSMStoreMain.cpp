@@ -0,0 +1,72 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <random>
+
+#include "LSMStore.hpp"
+
+using namespace std;
+
+// times n random inserts, then n random lookups once compaction settles
+void benchmark(LSMStore<int, long long>& s, int n) {
+    using namespace std::chrono;
+    mt19937 rng(42);
+
+    auto start = steady_clock::now();
+    for (int i = 0; i < n; i++)
+        s.insert(rng() % n, i);
+    s.commit();
+    long long ingest = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+    s.settle();
+    long long found = 0;
+    long long value;
+    start = steady_clock::now();
+    for (int i = 0; i < n; i++)
+        found += s.find(rng() % (2 * n), value);
+    long long lookups = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+    cout << "ingest: " << n * 1000000000LL / ingest << " records/s" << endl;
+    cout << "lookups: " << n * 1000000000LL / lookups << " /s (" << found << " found)" << endl;
+}
+
+int main() {
+    LSMStore<int, long long> s("C:/Temp/lsm_store");
+
+    while (true) {
+        cout << "op (i key value | r key | f key | c | b n | e)" << endl;
+
+        int key;
+        long long value;
+        char op;
+        cin >> op;
+        if (op == 'e')
+            return 0;
+
+        if (op == 'i') {
+            cin >> key >> value;
+            s.insert(key, value);
+        }
+        else if (op == 'r') {
+            cin >> key;
+            s.remove(key);
+        }
+        else if (op == 'f') {
+            cin >> key;
+            if (s.find(key, value))
+                cout << value << endl;
+            else
+                cout << "key not found" << endl;
+        }
+        else if (op == 'c')
+            s.commit();
+        else if (op == 'b') {
+            int n;
+            cin >> n;
+            benchmark(s, n);
+        }
+        else
+            cout << "type in a valid operation" << endl;
+        cout << s << endl;
+    }
+}
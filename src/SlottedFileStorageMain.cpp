@@ -0,0 +1,45 @@
+#include <iostream>
+#include <string>
+
+#include "SlottedFileStorage.hpp"
+
+using namespace std;
+
+int main() {
+    SlottedFileStorage<string> t("C:/Temp/slotted_file_storage.dat");
+
+    while (true) {
+        cout << "op page slot | op text | e" << endl;
+
+        char op;
+        cin >> op;
+        if (op == 'e')
+            return 0;
+
+        if (op == 'i') {
+            string text;
+            cin >> text;
+            cout << "Id: " << t.insert(text) << endl;
+        }
+        else {
+            unsigned int page, slot;
+            cin >> page >> slot;
+            RecordId id(page, slot);
+
+            if (op == 'r')
+                cout << "Read: " << t.read(id) << endl;
+            else if (op == 'u') {
+                string text;
+                cin >> text;
+                t.update(id, text);
+            }
+            else if (op == 'd')
+                t.remove(id);
+            else
+                cout << "type in a valid operation" << endl;
+        }
+        cout << t << endl;
+    }
+
+    return 0;
+}
@@ -1,17 +1,101 @@
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
 
 #include "SparseMatrix.hpp"
 
 using namespace std;
 
+// times products of an n x n matrix with about k random entries per row, in both layouts
+void benchmark(size_t n, size_t k) {
+    using namespace std::chrono;
+    typedef SparseMatrix<double> Matrix;
+    mt19937 rng(42);
+
+    vector<Matrix::Triplet> triplets;
+    for (size_t y = 0; y < n; y++) {
+        for (size_t i = 0; i < k; i++)
+            triplets.push_back(Matrix::Triplet{y, rng() % n, 1 + rng() % 100 / 100.0});
+    }
+
+    auto loaded = steady_clock::now();
+    Matrix a = Matrix::fromTriplets(0, n, n, triplets.begin(), triplets.end(), plus<double>());
+    cout << "load: " << triplets.size() / (duration_cast<nanoseconds>(steady_clock::now() - loaded).count() / 1e9)
+         << " triplets/s" << endl;
+
+    // every cell of a corner, row by row: a lookup each, against a cursor
+    const size_t corner = min<size_t>(n, 2000);
+    Matrix::RowCursor cells = a.cursor();
+    for (int cursor = 0; cursor < 2; cursor++) {
+        double sum = 0;
+        auto start = steady_clock::now();
+        for (size_t r = 0; r < corner; r++) {
+            for (size_t c = 0; c < corner; c++)
+                sum += cursor ? cells.at(r, c) : a.at(r, c);
+        }
+        double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+        cout << (cursor ? "cursor sweep: " : "at sweep: ") << seconds / (corner * corner) * 1e9
+             << " ns per cell (sum " << sum << ")" << endl;
+    }
+    vector<double> x(n, 1), y;
+
+    const int runs = 10;
+    for (Matrix::Layout layout : { Matrix::CSR, Matrix::CSC }) {
+        a.freeze(layout);
+        const double entries = static_cast<double>(a.nonZeros());
+        // bytes every product must move: the entries, offsets, x and y
+        const double bytes = entries * (sizeof(double) + sizeof(size_t)) + (n + 1) * sizeof(size_t) + 2 * n * sizeof(double);
+
+        for (int transposed = 0; transposed < 2; transposed++) {
+            // untimed, as the first allocation after freezing pays for the freed trees
+            a.multiply(x, y);
+
+            auto start = steady_clock::now();
+            for (int r = 0; r < runs; r++) {
+                if (transposed)
+                    a.multiplyTransposed(x, y);
+                else
+                    a.multiply(x, y);
+            }
+            double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9 / runs;
+
+            cout << (layout == Matrix::CSR ? "CSR " : "CSC ") << (transposed ? "A^T x: " : "A x: ")
+                 << 2 * entries / seconds / 1e9 << " GFLOP/s, "
+                 << bytes / seconds / 1e9 << " GB/s" << endl;
+        }
+    }
+
+    a.freeze(Matrix::CSR);
+    auto start = steady_clock::now();
+    Matrix c = a * a;
+    double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+    cout << "A A: " << c.nonZeros() << " nonzeros in " << seconds << " s" << endl;
+
+    // cold starts: parsing text, against mapping the binary file and reading it all once
+    a.writeMatrixMarket("C:/Temp/sparse_benchmark.mtx");
+    start = steady_clock::now();
+    Matrix parsed = Matrix::readMatrixMarket("C:/Temp/sparse_benchmark.mtx");
+    seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+    cout << "matrix market load: " << seconds << " s" << endl;
+
+    a.save("C:/Temp/sparse_benchmark.bin");
+    start = steady_clock::now();
+    Matrix mapped = Matrix::map("C:/Temp/sparse_benchmark.bin");
+    mapped.multiply(x, y);
+    seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+    cout << "binary map and first A x: " << seconds << " s" << endl;
+}
+
 int main() {
     SparseMatrix<int> m(0, 10, 10);
     try {
         while (true) {
             string s;
-            cout << "op num | e" << endl;
+            cout << "op num | f (freeze CSR) | c (freeze CSC) | t (thaw) | p (print m m) | v col | k col | s (save) | m (map) | w (write mtx) | r (read mtx) | b n k | e" << endl;
 
             int x, y, val;
             char op;
@@ -19,6 +103,56 @@ int main() {
             if (op == 'e')
                 return 0;
 
+            if (op == 'b') {
+                size_t n, k;
+                cin >> n >> k;
+                benchmark(n, k);
+                continue;
+            }
+
+            if (op == 'p') {
+                m.freeze(SparseMatrix<int>::CSR);
+                cout << m * m << endl;
+                continue;
+            }
+
+            if (op == 's' || op == 'm' || op == 'w' || op == 'r') {
+                if (op == 's') {
+                    m.freeze(SparseMatrix<int>::CSR);
+                    m.save("C:/Temp/sparse_matrix.bin");
+                }
+                else if (op == 'm')
+                    m = SparseMatrix<int>::map("C:/Temp/sparse_matrix.bin");
+                else if (op == 'w')
+                    m.writeMatrixMarket("C:/Temp/sparse_matrix.mtx");
+                else
+                    m = SparseMatrix<int>::readMatrixMarket("C:/Temp/sparse_matrix.mtx", SparseMatrix<int>::TREES);
+                cout << m << endl;
+                continue;
+            }
+
+            if (op == 'f' || op == 'c' || op == 't') {
+                if (op == 't')
+                    m.thaw();
+                else
+                    m.freeze(op == 'f' ? SparseMatrix<int>::CSR : SparseMatrix<int>::CSC);
+                cout << m << endl << m.nonZeros() << " nonzeros" << endl;
+                continue;
+            }
+
+            if (op == 'v' || op == 'k') {
+                cin >> x;
+                if (op == 'k')
+                    m.purgeCol(x);
+                else {
+                    for (auto entry : m.colEntries(x))
+                        cout << "(" << entry.index << ":" << entry.value << ")";
+                    cout << endl;
+                }
+                cout << m << endl;
+                continue;
+            }
+
             cin >> x >> y >> val;
             if (op == 'i')
                 m[x][y] = val;